@@ -0,0 +1,1484 @@
+#include "MemoryManagement.h"
+
+// main and the runner are in UnitTests.cpp
+#include "catch.h"
+
+#include "AssignmentTestHarness.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Tests for the allocator extensions built on top of the assignment allocators.
+// Everything here makes its own allocators - only the system blocks are shared with the harness.
+
+static bool is_all_zero(const void* ptr, size_t size)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(ptr);
+	for (size_t i = 0; i < size; ++i)
+	{
+		if (p[i] != 0)
+			return false;
+	}
+	return true;
+}
+
+static std::vector<uint8_t> read_file(const char* filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const char* filename, const std::vector<uint8_t>& bytes)
+{
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+template <class T>
+static void poke(std::vector<uint8_t>& bytes, size_t offset, T value)
+{
+	memcpy(bytes.data() + offset, &value, sizeof(T));
+}
+
+
+TEST_CASE("SmallObject: Pool chains slabs when full and shrinks them back", "[Extensions]")
+{
+	constexpr size_t kMaxAllocs = 16;
+	constexpr size_t kSlabAllocs = 8;
+	constexpr size_t kAllocs = 40;
+
+	ObjectPoolManager pool(kMaxAllocs, MemoryMappingType::kCPU, kSlabAllocs);
+
+	std::vector<void*> allocs;
+	for (size_t i = 0; i < kAllocs; ++i)
+	{
+		void* p = pool.allocate(32, 16);
+		REQUIRE(p != nullptr);
+		memset(p, (int)i, 32);
+		allocs.push_back(p);
+	}
+	REQUIRE(pool.get_slab_count() > 1);
+	REQUIRE(pool.get_live_count() == kAllocs);
+	REQUIRE(pool.get_capacity() >= kAllocs);
+
+	// nothing handed out twice or overwritten by a later slab
+	for (size_t i = 0; i < kAllocs; ++i)
+	{
+		REQUIRE(pool.owns(allocs[i]));
+		REQUIRE(static_cast<uint8_t*>(allocs[i])[31] == (uint8_t)i);
+	}
+
+	for (void* p : allocs)
+		pool.release(p);
+	pool.shrink_slabs();
+	REQUIRE(pool.get_slab_count() == 1);
+	REQUIRE(pool.get_live_count() == 0);
+
+	// the first slab still holds the full count before another is chained
+	for (size_t i = 0; i < kMaxAllocs; ++i)
+		REQUIRE(pool.allocate(32, 16) != nullptr);
+	REQUIRE(pool.get_slab_count() == 1);
+	REQUIRE(pool.allocate(32, 16) != nullptr);
+	REQUIRE(pool.get_slab_count() == 2);
+}
+
+TEST_CASE("SmallObject: Bitmap search finds freed slots either side of a word boundary", "[Extensions]")
+{
+	constexpr size_t kAllocs = 300;
+
+	ObjectPoolManager pool(kAllocs, MemoryMappingType::kCPU);
+
+	std::vector<void*> allocs;
+	for (size_t i = 0; i < kAllocs; ++i)
+		allocs.push_back(pool.allocate(32, 16));
+	REQUIRE(pool.get_slab_count() == 1);
+
+	// 63/64 and 127/128 straddle the 64 bit words, 299 is in the last partial one
+	const size_t freed[] = { 299, 128, 64, 127, 63 };
+	for (size_t index : freed)
+		pool.release(allocs[index]);
+	REQUIRE(pool.get_live_count() == kAllocs - 5);
+
+	// lowest address first
+	const size_t expected[] = { 63, 64, 127, 128, 299 };
+	for (size_t index : expected)
+		REQUIRE(pool.allocate(32, 16) == allocs[index]);
+	REQUIRE(pool.get_live_count() == kAllocs);
+	REQUIRE(pool.get_slab_count() == 1);
+}
+
+TEST_CASE("ScratchSpace: Arena images reload relocated and refuse corrupt files", "[Extensions]")
+{
+	struct listNode {
+		listNode* next;
+		uint32_t value;
+	};
+	constexpr uint32_t kNodes = 100;
+	const char* kImage = "extension_test.img";
+	const char* kBadImage = "extension_test_bad.img";
+
+	StackAllocator source(64 * KB, MemoryMappingType::kCPU);
+	listNode* prev = nullptr;
+	for (uint32_t i = 0; i < kNodes; ++i)
+	{
+		listNode* node = static_cast<listNode*>(source.allocate(sizeof(listNode), alignof(listNode)));
+		node->next = nullptr;
+		node->value = i;
+		if (prev)
+		{
+			prev->next = node;
+			source.add_relocation(reinterpret_cast<void**>(&prev->next));
+		}
+		prev = node;
+	}
+	REQUIRE(source.save_image(kImage));
+
+	const std::vector<uint8_t> image = read_file(kImage);
+	REQUIRE(image.size() > 40);
+
+	SECTION("a good image loads at a new address with its pointers fixed up")
+	{
+		StackAllocator target(64 * KB, MemoryMappingType::kCPU);
+		target.allocate(24, 8);
+		listNode* node = static_cast<listNode*>(target.load_image(kImage));
+		REQUIRE(node != nullptr);
+		REQUIRE(static_cast<void*>(node) != static_cast<void*>(source.get_memblock()));
+
+		uint32_t count = 0;
+		for (; node; node = node->next)
+		{
+			REQUIRE(target.owns(node));
+			REQUIRE(node->value == count);
+			++count;
+		}
+		REQUIRE(count == kNodes);
+	}
+
+	SECTION("a bad image is refused without touching the stack")
+	{
+		std::vector<uint8_t> bad = image;
+		SECTION("truncated") { bad.resize(bad.size() - 100); }
+		SECTION("region past the end of the file") { poke<uint64_t>(bad, 16, (uint64_t)bad.size()); }
+		SECTION("relocation table past its space") { poke<uint64_t>(bad, 24, (uint64_t)1 << 40); }
+		SECTION("relocation slot past the region") { poke<uint64_t>(bad, 40, (uint64_t)kNodes * sizeof(listNode) - 4); }
+		write_file(kBadImage, bad);
+
+		StackAllocator target(64 * KB, MemoryMappingType::kCPU);
+		target.allocate(24, 8);
+		uint8_t* top = target.get_memLoc();
+		REQUIRE(target.load_image(kBadImage) == nullptr);
+		REQUIRE(target.get_memLoc() == top);
+		std::remove(kBadImage);
+	}
+
+	std::remove(kImage);
+}
+
+TEST_CASE("Snapshot: Capture and restore round trip, refused once the layout changes", "[Extensions]")
+{
+	constexpr size_t kInts = 16 * KB;
+	constexpr size_t kPoolAllocs = 64;
+
+	StackAllocator stack(1 * MB, MemoryMappingType::kUndefined);
+	ObjectPoolManager pool(kPoolAllocs, MemoryMappingType::kUndefined);
+
+	int* values = static_cast<int*>(stack.allocate(kInts * sizeof(int), 64));
+	for (size_t i = 0; i < kInts; ++i)
+		values[i] = (int)i;
+	std::vector<void*> packs;
+	for (size_t i = 0; i < 10; ++i)
+	{
+		packs.push_back(pool.allocate(16, 8));
+		memset(packs.back(), (int)i, 16);
+	}
+
+	ArenaSnapshot snapshot;
+	snapshot.add_allocator(&stack);
+	snapshot.add_allocator(&pool);
+	REQUIRE(snapshot.capture());
+
+	// scribble over data and bookkeeping
+	values[5] = -1;
+	values[kInts - 1] = -2;
+	void* extra = stack.allocate(1000, 8);
+	pool.release(packs[0]);
+	memset(packs[9], 0xff, 16);
+
+	REQUIRE(snapshot.restore());
+	for (size_t i = 0; i < kInts; ++i)
+		REQUIRE(values[i] == (int)i);
+	for (size_t i = 0; i < packs.size(); ++i)
+		REQUIRE(static_cast<uint8_t*>(packs[i])[3] == (uint8_t)i);
+	REQUIRE(pool.get_live_count() == packs.size());
+	REQUIRE(stack.allocate(1000, 8) == extra);
+
+	// a new slab isnt in the checkpoint
+	for (size_t i = 0; i < kPoolAllocs; ++i)
+		pool.allocate(16, 8);
+	REQUIRE(pool.get_slab_count() > 1);
+	REQUIRE_FALSE(snapshot.restore());
+}
+
+TEST_CASE("SingleFrameGPU: Fenced ring wraps, retires and stalls", "[Extensions]")
+{
+	constexpr size_t kRingSize = 16 * KB;
+	constexpr size_t kFrameBytes = 6 * KB;
+
+	SECTION("frames wrap round the ring once the GPU has finished with them")
+	{
+		// the previous frame is always kept, so the ring never empties and starts again from the bottom
+		SimulatedGpuTimeline gpu(0);
+		FencedRingAllocator ring(kRingSize, MemoryMappingType::kGPU, &gpu, 2);
+
+		uint8_t* last = nullptr;
+		size_t wraps = 0;
+		for (int frame = 0; frame < 10; ++frame)
+		{
+			uint8_t* p = static_cast<uint8_t*>(ring.allocate(kFrameBytes, 16));
+			REQUIRE(p != nullptr);
+			REQUIRE(ring.owns(p));
+			if (last)
+			{
+				// the frame still in flight is untouched
+				REQUIRE(last[0] == (uint8_t)(frame - 1));
+				REQUIRE(last[kFrameBytes - 1] == (uint8_t)(frame - 1));
+				if (p < last)
+					++wraps;
+			}
+			last = p;
+			memset(p, frame, kFrameBytes);
+
+			ring.handle_signals(GameEventType::kEventNextFrame);
+			gpu.wait_for_fence(gpu.get_signalled_fence());
+		}
+		REQUIRE(wraps > 0);
+		REQUIRE(ring.get_overflow_count() == 0);
+		REQUIRE(ring.get_stall_count() == 0);
+	}
+
+	SECTION("frames younger than the minimum are kept after the GPU is done")
+	{
+		SimulatedGpuTimeline gpu(0);
+		FencedRingAllocator ring(kRingSize, MemoryMappingType::kGPU, &gpu, 3);
+
+		for (int frame = 0; frame < 4; ++frame)
+		{
+			REQUIRE(ring.allocate(1 * KB, 16) != nullptr);
+			ring.end_frame();
+		}
+		gpu.wait_for_fence(gpu.get_signalled_fence());
+		// the frame being built counts, so the newest two closed ones stay
+		ring.retire_completed();
+		REQUIRE(ring.get_frames_in_flight() == 2);
+	}
+
+	SECTION("a full ring waits on the oldest frame when it cant overflow")
+	{
+		SimulatedGpuTimeline gpu(100000);
+		FencedRingAllocator ring(kRingSize, MemoryMappingType::kGPU, &gpu);
+		// the hard budget stops overflow, so the only way on is to wait
+		ring.set_tag_budget(AllocTag::kUntagged, 0, kRingSize);
+
+		uint8_t* first = static_cast<uint8_t*>(ring.allocate(2 * kFrameBytes, 16));
+		REQUIRE(first != nullptr);
+		ring.end_frame();
+		REQUIRE(gpu.get_completed_fence() < gpu.get_signalled_fence());
+
+		uint8_t* second = static_cast<uint8_t*>(ring.allocate(2 * kFrameBytes, 16));
+		REQUIRE(second == first);
+		REQUIRE(ring.get_stall_count() == 1);
+		REQUIRE(ring.get_overflow_count() == 0);
+		REQUIRE(gpu.get_completed_fence() >= 1);
+	}
+}
+
+TEST_CASE("SingleFrameGPU: Deferred releases wait for both the frame count and the fence", "[Extensions]")
+{
+	constexpr uint32_t kMinFrames = 2;
+	constexpr size_t kAllocs = 5;
+
+	SimulatedGpuTimeline gpu(100000);
+	StackAllocator parent(64 * KB, MemoryMappingType::kGPU);
+	DeferredReleaseAllocator deferred(&parent, kMinFrames, &gpu);
+
+	deferred.allocate(100, 16);
+	uint8_t* start = parent.get_memLoc();
+	REQUIRE(start != nullptr);
+	void* allocs[kAllocs];
+	for (size_t i = 0; i < kAllocs; ++i)
+		allocs[i] = deferred.allocate(1 * KB, 16);
+
+	// out of order - the queue gives them back top down so the stack can pop them all
+	const size_t order[] = { 1, 3, 4, 2, 0 };
+	for (size_t index : order)
+		deferred.release_sized(allocs[index], 1 * KB, 16);
+	gpu.signal();
+	REQUIRE(deferred.get_pending_count() == kAllocs);
+	REQUIRE(deferred.get_pending_bytes() == kAllocs * KB);
+
+	// enough frames, but the GPU is still busy
+	for (uint32_t frame = 0; frame <= kMinFrames; ++frame)
+	{
+		deferred.handle_signals(GameEventType::kEventNextFrame);
+		REQUIRE(deferred.get_pending_count() == kAllocs);
+	}
+	REQUIRE(parent.get_memLoc() > start);
+
+	gpu.wait_for_fence(gpu.get_signalled_fence());
+	deferred.handle_signals(GameEventType::kEventNextFrame);
+	REQUIRE(deferred.get_pending_count() == 0);
+	REQUIRE(deferred.get_deferred_release_count() == kAllocs);
+	// padding in front of each one goes too, so the stack is back where it started
+	REQUIRE(parent.get_memLoc() == start);
+	REQUIRE(parent.get_tag_usage(AllocTag::kUntagged) == 100);
+
+	// the fence has passed, but not enough frames have
+	void* late = deferred.allocate(64, 16);
+	deferred.release(late);
+	gpu.signal();
+	gpu.wait_for_fence(gpu.get_signalled_fence());
+	deferred.handle_signals(GameEventType::kEventNextFrame);
+	REQUIRE(deferred.get_pending_count() == 1);
+
+	// unload doesnt wait for frames
+	deferred.handle_signals(GameEventType::kEventLevelUnload);
+	REQUIRE(deferred.get_pending_count() == 0);
+}
+
+TEST_CASE("SingleFrameGPU: Upload stager merges contiguous copies and keeps queue order", "[Extensions]")
+{
+	constexpr size_t kChunk = 256;
+	constexpr size_t kChunks = 64;
+
+	std::vector<uint8_t> source(kChunks * kChunk);
+	for (size_t i = 0; i < source.size(); ++i)
+		source[i] = (uint8_t)(i * 7);
+
+	for (int useWorker = 0; useWorker < 2; ++useWorker)
+	{
+		StackAllocator gpu(64 * KB, MemoryMappingType::kGPU);
+		UploadStager stager(useWorker != 0);
+
+		// back to back at both ends - one copy
+		uint8_t* dst = static_cast<uint8_t*>(gpu.allocate(source.size(), kChunk));
+		for (size_t i = kChunks; i-- > 0;)
+			stager.queue_copy(dst + i * kChunk, source.data() + i * kChunk, kChunk);
+
+		// the same destination twice - the later request has to land last
+		uint8_t* target = static_cast<uint8_t*>(gpu.allocate(16, 16));
+		const uint8_t firstSource[16] = { 1 };
+		const uint8_t secondSource[16] = { 2 };
+		stager.queue_copy(target, firstSource, sizeof(firstSource));
+		stager.queue_copy(target, secondSource, sizeof(secondSource));
+		REQUIRE(stager.get_queued_count() == kChunks + 2);
+
+		stager.flush();
+		stager.wait_complete();
+
+		REQUIRE(memcmp(dst, source.data(), source.size()) == 0);
+		REQUIRE(target[0] == 2);
+		REQUIRE(stager.get_request_count() == kChunks + 2);
+		REQUIRE(stager.get_copy_count() == 3);
+		REQUIRE(stager.get_bytes_uploaded() == source.size() + 32);
+	}
+}
+
+TEST_CASE("Harness: Lifetime event registry runs listeners by priority, ties in subscription order", "[Extensions]")
+{
+	LifetimeEventRegistry registry;
+	std::vector<int> calls;
+
+	registry.subscribe(GameEventType::kEventNextFrame, LifetimeEventRegistry::kPriorityLast, [&calls](GameEventType) { calls.push_back(4); });
+	registry.subscribe(GameEventType::kEventNextFrame, LifetimeEventRegistry::kPriorityDefault, [&calls](GameEventType) { calls.push_back(2); });
+	uint32_t dropped = registry.subscribe(GameEventType::kEventNextFrame, LifetimeEventRegistry::kPriorityDefault, [&calls](GameEventType) { calls.push_back(-1); });
+	registry.subscribe(GameEventType::kEventNextFrame, LifetimeEventRegistry::kPriorityFirst, [&calls](GameEventType) { calls.push_back(1); });
+	registry.subscribe(GameEventType::kEventNextFrame, LifetimeEventRegistry::kPriorityDefault, [&calls](GameEventType) { calls.push_back(3); });
+	registry.subscribe(GameEventType::kEventLevelUnload, LifetimeEventRegistry::kPriorityFirst, [&calls](GameEventType) { calls.push_back(-2); });
+
+	registry.unsubscribe(dropped);
+	REQUIRE(registry.get_listener_count(GameEventType::kEventNextFrame) == 4);
+
+	registry.dispatch(GameEventType::kEventNextFrame);
+	REQUIRE(calls == std::vector<int>({ 1, 2, 3, 4 }));
+
+	// nothing listening is fine
+	calls.clear();
+	registry.dispatch(GameEventType::kEventLevelLoadComplete);
+	REQUIRE(calls.empty());
+}
+
+TEST_CASE("System Region Broker: Released regions coalesce", "[Extensions]")
+{
+	constexpr size_t kRegionSize = 256 * KB;
+
+	systemBrokerStats before = get_system_broker_stats();
+
+	uint8_t* first = static_cast<uint8_t*>(acquire_system_region(kRegionSize, MemoryMappingType::kCPU));
+	uint8_t* second = static_cast<uint8_t*>(acquire_system_region(kRegionSize, MemoryMappingType::kCPU));
+	REQUIRE(first != nullptr);
+	REQUIRE(second == first + kRegionSize);
+	REQUIRE(is_within_mapped_block(first, MemoryMappingType::kCPU));
+	REQUIRE(get_system_broker_stats().regionCount == before.regionCount + 2);
+	memset(first, 0xab, 2 * kRegionSize);
+
+	// freed the other way round, the two halves still join back up
+	release_system_region(second);
+	release_system_region(first);
+	REQUIRE(get_system_broker_stats().regionCount == before.regionCount);
+	REQUIRE(get_system_broker_stats().regionBytes == before.regionBytes);
+
+	uint8_t* joined = static_cast<uint8_t*>(acquire_system_region(2 * kRegionSize, MemoryMappingType::kCPU));
+	REQUIRE(joined != nullptr);
+	REQUIRE(joined <= first);
+	REQUIRE(joined + 2 * kRegionSize >= second + kRegionSize);
+	release_system_region(joined);
+	REQUIRE(get_system_broker_stats().regionBytes == before.regionBytes);
+}
+
+TEST_CASE("ScratchSpace: Zeroed allocations are zero after reuse", "[Extensions]")
+{
+	constexpr size_t kSize = 256 * KB;
+
+	SECTION("stack reused after a flush")
+	{
+		StackAllocator stack(kSize, MemoryMappingType::kCPU);
+		void* p = stack.allocate_zeroed(kSize / 2, 16);
+		REQUIRE(is_all_zero(p, kSize / 2));
+		memset(p, 0xcd, kSize / 2);
+
+		stack.handle_signals(GameEventType::kEventFlushScratchSpace);
+		p = stack.allocate_zeroed(kSize, 16);
+		REQUIRE(p != nullptr);
+		REQUIRE(is_all_zero(p, kSize));
+	}
+
+	SECTION("pool packs reused after release")
+	{
+		ObjectPoolManager pool(64, MemoryMappingType::kCPU);
+		std::vector<void*> packs;
+		for (int i = 0; i < 10; ++i)
+		{
+			void* p = pool.allocate_zeroed(64, 16);
+			REQUIRE(is_all_zero(p, 64));
+			memset(p, 0xee, 64);
+			packs.push_back(p);
+		}
+		for (void* p : packs)
+			pool.release(p);
+		for (int i = 0; i < 12; ++i)
+			REQUIRE(is_all_zero(pool.allocate_zeroed(48, 16), 48));
+	}
+
+	SECTION("a region handed back dirty, then handed out again")
+	{
+		StackAllocator* dirty = new StackAllocator(kSize, MemoryMappingType::kCPU);
+		memset(dirty->allocate(kSize, 16), 0x55, kSize);
+		delete dirty;
+
+		StackAllocator reused(kSize, MemoryMappingType::kCPU);
+		REQUIRE(is_all_zero(reused.allocate_zeroed(kSize, 16), kSize));
+	}
+
+	SECTION("a fresh block may be reused heap, so it is cleared too")
+	{
+		StackAllocator fresh(kSize, MemoryMappingType::kCPU);
+		REQUIRE(is_all_zero(fresh.allocate_zeroed(kSize, 16), kSize));
+		REQUIRE(fresh.get_zero_cleared_bytes() == kSize);
+	}
+}
+
+TEST_CASE("SmallObject: Pool reset frees every slot and hands them out again", "[Extensions]")
+{
+	constexpr size_t kMaxAllocs = 256;
+	constexpr size_t kSlabAllocs = 128;
+	constexpr size_t kAllocs = 300;
+
+	ObjectPoolManager pool(kMaxAllocs, MemoryMappingType::kUndefined, kSlabAllocs);
+
+	std::vector<void*> allocs;
+	for (size_t i = 0; i < kAllocs; ++i)
+	{
+		void* p = pool.allocate(64, 16);
+		REQUIRE(p != nullptr);
+		memset(p, 0xaa, 64);
+		allocs.push_back(p);
+	}
+	size_t slabs = pool.get_slab_count();
+	REQUIRE(slabs > 1);
+
+	pool.reset();
+	REQUIRE(pool.get_live_count() == 0);
+	REQUIRE(pool.get_slab_count() == slabs);
+	// used is every pack ever handed out - reset doesnt make them clean
+	REQUIRE(pool.get_used_count() == kAllocs);
+
+	// same slots again, in the same order, without chaining anything new
+	for (size_t i = 0; i < kAllocs; ++i)
+	{
+		void* p = (i == 0) ? pool.allocate_zeroed(64, 16) : pool.allocate(64, 16);
+		REQUIRE(p == allocs[i]);
+		if (i == 0)
+			REQUIRE(is_all_zero(p, 64));
+	}
+	REQUIRE(pool.get_live_count() == kAllocs);
+	REQUIRE(pool.get_slab_count() == slabs);
+}
+
+#if PMR_ADAPTERS_ON == 1
+TEST_CASE("LevelCPU: Popping through the pmr adapters gives back the tag charge", "[Extensions]")
+{
+	constexpr size_t kHardBudget = 100 * KB;
+	constexpr size_t kCycles = 1000;
+
+	StackAllocator stack(256 * KB, MemoryMappingType::kCPU);
+	stack.set_tag_budget(AllocTag::kUntagged, 0, kHardBudget);
+	// a byte in so every pop has padding in front of it as well
+	REQUIRE(stack.allocate(1, 1) != nullptr);
+	uint8_t* start = stack.get_memLoc();
+
+	SECTION("allocate and pop directly")
+	{
+		for (size_t i = 0; i < kCycles; ++i)
+		{
+			void* p = stack.allocate(256, 16);
+			REQUIRE(p != nullptr);
+			stack.release_sized(p, 256, 16);
+		}
+	}
+
+	SECTION("a reserved pmr vector made and dropped on the stack fast path")
+	{
+		StackResource<StackAllocator> resource(&stack);
+		for (size_t i = 0; i < kCycles; ++i)
+		{
+			std::pmr::vector<uint32_t> values(&resource);
+			values.reserve(64);
+			for (uint32_t v = 0; v < 64; ++v)
+				values.push_back(v);
+			REQUIRE(values[63] == 63);
+		}
+	}
+
+	SECTION("a reserved pmr vector made and dropped through the vtable")
+	{
+		AllocatorResource resource(&stack);
+		for (size_t i = 0; i < kCycles; ++i)
+		{
+			std::pmr::vector<uint32_t> values(&resource);
+			values.reserve(64);
+			values.resize(64, (uint32_t)i);
+		}
+	}
+
+	REQUIRE(stack.get_memLoc() == start);
+	REQUIRE(stack.get_tag_usage(AllocTag::kUntagged) == 1);
+	REQUIRE(stack.get_tag_peak(AllocTag::kUntagged) <= 1 + 256);
+
+	// the budget is all still there
+	void* big = stack.allocate(kHardBudget - 1, 1);
+	REQUIRE(big != nullptr);
+	REQUIRE(stack.allocate(1, 1) == nullptr);
+}
+#endif
+
+TEST_CASE("SingleFrameGPU: Popping inside a frame keeps the ring's tag usage right", "[Extensions]")
+{
+	constexpr size_t kRingSize = 16 * KB;
+	constexpr size_t kCycles = 100;
+
+	SimulatedGpuTimeline gpu(0);
+	FencedRingAllocator ring(kRingSize, MemoryMappingType::kGPU, &gpu);
+	ring.set_tag_budget(AllocTag::kRender, 0, 4 * KB);
+	ScopedAllocTag tag(AllocTag::kRender);
+
+	for (int frame = 0; frame < 3; ++frame)
+	{
+		void* kept = ring.allocate(100, 16);
+		REQUIRE(kept != nullptr);
+		uint8_t* head = ring.get_memLoc();
+		for (size_t i = 0; i < kCycles; ++i)
+		{
+			void* p = ring.allocate(1 * KB, 64);
+			REQUIRE(p != nullptr);
+			ring.release_sized(p, 1 * KB, 64);
+			REQUIRE(ring.get_memLoc() == head);
+		}
+		REQUIRE(ring.get_tag_usage(AllocTag::kRender) == 100);
+
+		ring.end_frame();
+		gpu.wait_for_fence(gpu.get_signalled_fence());
+		ring.retire_completed();
+		REQUIRE(ring.get_frames_in_flight() == 0);
+		REQUIRE(ring.get_tag_usage(AllocTag::kRender) == 0);
+	}
+
+	// a frame that has ended is fenced - nothing in it pops
+	void* old = ring.allocate(1 * KB, 16);
+	ring.end_frame();
+	uint8_t* head = ring.get_memLoc();
+	ring.release_sized(old, 1 * KB, 16);
+	REQUIRE(ring.get_memLoc() == head);
+}
+
+TEST_CASE("SingleFrameCPU: Frame and scratch vectors grow in place on the top of the stack", "[Extensions]")
+{
+	constexpr uint32_t kItems = 1000;
+
+	SECTION("a frame vector grows in place and stays charged to the tag it was made under")
+	{
+		MultiFrameAllocator frame(64 * KB, MemoryMappingType::kCPU);
+		{
+			ScopedAllocTag ui(AllocTag::kUI);
+			FrameVector<uint32_t> values(&frame);
+			values.push_back(0);
+			REQUIRE(frame.get_tag_usage(AllocTag::kUI) == 8 * sizeof(uint32_t));
+
+			// growing it somewhere else doesnt move the bytes to another budget
+			{
+				ScopedAllocTag audio(AllocTag::kAudio);
+				for (uint32_t i = 1; i < kItems; ++i)
+					values.push_back(i);
+			}
+			REQUIRE(values.size() == kItems);
+			REQUIRE(values.get_relocation_count() == 0);
+			REQUIRE(frame.get_tag_usage(AllocTag::kAudio) == 0);
+			REQUIRE(frame.get_tag_usage(AllocTag::kUI) == values.get_capacity() * sizeof(uint32_t));
+			for (uint32_t i = 0; i < kItems; ++i)
+				REQUIRE(values[i] == i);
+		}
+		// popped on the way out
+		REQUIRE(frame.get_tag_usage(AllocTag::kUI) == 0);
+		REQUIRE(frame.get_bytes_in_use() == 0);
+	}
+
+	SECTION("a scratch vector moves when something lands on top of it and keeps its items")
+	{
+		StackAllocator scratch(64 * KB, MemoryMappingType::kCPU);
+		ScratchVector<uint64_t> values(&scratch, 8);
+		REQUIRE(values.get_capacity() == 8);
+		for (uint64_t i = 0; i < 8; ++i)
+			values.push_back(i);
+
+		void* blocker = scratch.allocate(16, 16);
+		REQUIRE(blocker != nullptr);
+		values.push_back(8);
+		REQUIRE(values.get_relocation_count() == 1);
+		REQUIRE(values.data() > blocker);
+
+		// newest again, so the next growth extends
+		for (uint64_t i = 9; i < kItems; ++i)
+			values.push_back(i);
+		REQUIRE(values.get_relocation_count() == 1);
+		for (uint64_t i = 0; i < kItems; ++i)
+			REQUIRE(values[i] == i);
+	}
+}
+
+// a stack the system never has a main block for
+class StarvedStackAllocator : public StackAllocator {
+public:
+	StarvedStackAllocator(size_t size, MemoryMappingType type) : StackAllocator(size, type) {};
+	bool ensure_main_block() { return false; };
+};
+
+static int s_numaTestCreated = 0;
+static StackAllocator* create_first_fed_then_starved()
+{
+	if (s_numaTestCreated++ == 0)
+		return new StackAllocator(64 * KB, MemoryMappingType::kCPU);
+	return new StarvedStackAllocator(64 * KB, MemoryMappingType::kCPU);
+}
+static StackAllocator* create_starved()
+{
+	return new StarvedStackAllocator(64 * KB, MemoryMappingType::kCPU);
+}
+
+TEST_CASE("ScratchSpace: NUMA instances fall back to remote memory, then to overflow", "[Extensions]")
+{
+	const int local = get_current_numa_node();
+	const int other = (local + 1) % kMaxNumaNodes;
+
+	SECTION("a node without a block uses a node that has one")
+	{
+		s_numaTestCreated = 0;
+		NumaLocalAllocator numa(create_first_fed_then_starved);
+		StackAllocator* remote = numa.get_node_allocator(other);
+		REQUIRE(remote->ensure_main_block());
+
+		void* p = numa.allocate(256, 16);
+		REQUIRE(p != nullptr);
+		REQUIRE(remote->owns(p));
+		REQUIRE(numa.owns(p));
+		// the local instance is kept to try again next time
+		REQUIRE(numa.get_node_allocator(local)->get_memblock() == nullptr);
+		REQUIRE(numa.get_bytes_in_use() == 256);
+	}
+
+	SECTION("nobody has a block - the local instance chains overflow")
+	{
+		NumaLocalAllocator numa(create_starved);
+		void* p = numa.allocate(256, 16);
+		REQUIRE(p != nullptr);
+
+		StackAllocator* starved = numa.get_node_allocator(local);
+		REQUIRE(starved->get_memblock() == nullptr);
+		REQUIRE(starved->owns(p));
+		REQUIRE(starved->get_overflow_count() == 1);
+		memset(p, 0x11, 256);
+	}
+}
+
+struct budgetEvent {
+	AllocTag tag;
+	size_t used;
+	size_t budget;
+	bool isHard;
+};
+static std::vector<budgetEvent> s_budgetEvents;
+static void record_budget_event(IMemoryAllocatorX*, AllocTag tag, size_t used, size_t budget, bool isHard)
+{
+	s_budgetEvents.push_back({ tag, used, budget, isHard });
+}
+
+TEST_CASE("SmallObject: Tag budgets warn past soft, refuse past hard and refund on release", "[Extensions]")
+{
+	constexpr size_t kPack = sizeof(ObjectPoolManager::dataPack);
+
+	s_budgetEvents.clear();
+	ObjectPoolManager pool(64, MemoryMappingType::kCPU);
+	pool.set_budget_callback(record_budget_event);
+	pool.set_tag_budget(AllocTag::kPhysics, 2 * kPack, 4 * kPack);
+
+	std::vector<void*> physics;
+	{
+		ScopedAllocTag tag(AllocTag::kPhysics);
+		for (int i = 0; i < 4; ++i)
+			physics.push_back(pool.allocate(32, 16));
+		REQUIRE(pool.allocate(32, 16) == nullptr);
+	}
+	for (void* p : physics)
+		REQUIRE(p != nullptr);
+
+	// one soft warning going over, then the refusal
+	REQUIRE(s_budgetEvents.size() == 2);
+	REQUIRE(s_budgetEvents[0].tag == AllocTag::kPhysics);
+	REQUIRE(!s_budgetEvents[0].isHard);
+	REQUIRE(s_budgetEvents[0].used == 3 * kPack);
+	REQUIRE(s_budgetEvents[1].isHard);
+	REQUIRE(s_budgetEvents[1].used == 5 * kPack);
+	REQUIRE(pool.get_tag_usage(AllocTag::kPhysics) == 4 * kPack);
+	REQUIRE(pool.is_over_soft_budget(AllocTag::kPhysics));
+
+	// other tags have their own budgets
+	REQUIRE(pool.allocate(32, 16) != nullptr);
+	REQUIRE(pool.get_tag_usage(AllocTag::kUntagged) == kPack);
+
+	// released under another tag, still refunded to the one it was charged to
+	{
+		ScopedAllocTag tag(AllocTag::kAudio);
+		pool.release(physics.back());
+	}
+	physics.pop_back();
+	REQUIRE(pool.get_tag_usage(AllocTag::kPhysics) == 3 * kPack);
+	REQUIRE(pool.get_tag_peak(AllocTag::kPhysics) == 4 * kPack);
+	{
+		ScopedAllocTag tag(AllocTag::kPhysics);
+		physics.push_back(pool.allocate(32, 16));
+		REQUIRE(physics.back() != nullptr);
+	}
+	REQUIRE(s_budgetEvents.size() == 2);
+}
+
+TEST_CASE("LevelCPU: Rolling back to the marker restores tag usage", "[Extensions]")
+{
+	RollbackStackAllocator level(64 * KB, MemoryMappingType::kCPU);
+	REQUIRE(level.allocate(1 * KB, 16) != nullptr);
+
+	level.handle_signals(GameEventType::kEventLevelBeginLoad);
+	{
+		ScopedAllocTag tag(AllocTag::kAI);
+		REQUIRE(level.allocate(4 * KB, 16) != nullptr);
+	}
+	REQUIRE(level.get_tag_usage(AllocTag::kAI) == 4 * KB);
+
+	level.handle_signals(GameEventType::kEventLevelUnload);
+	REQUIRE(level.get_tag_usage(AllocTag::kAI) == 0);
+	REQUIRE(level.get_tag_usage(AllocTag::kUntagged) == 1 * KB);
+	REQUIRE(level.get_tag_peak(AllocTag::kAI) == 4 * KB);
+}
+
+static StackAllocator* create_scratch_for_budget()
+{
+	return new StackAllocator(256 * KB, MemoryMappingType::kCPU);
+}
+
+TEST_CASE("ScratchSpace: NUMA instances share a budget between them", "[Extensions]")
+{
+	NumaLocalAllocator numa(create_scratch_for_budget);
+	numa.set_tag_budget(AllocTag::kStreaming, 0, 64 * KB);
+
+	// the local instance only gets its share
+	size_t soft, hard;
+	numa.get_node_allocator(get_current_numa_node())->get_tag_budget(AllocTag::kStreaming, soft, hard);
+	REQUIRE(hard * get_numa_node_count() <= 64 * KB);
+	REQUIRE(hard > 0);
+
+	ScopedAllocTag tag(AllocTag::kStreaming);
+	REQUIRE(numa.allocate(hard, 16) != nullptr);
+	REQUIRE(numa.allocate(1, 1) == nullptr);
+	REQUIRE(numa.get_tag_usage(AllocTag::kStreaming) == hard);
+	REQUIRE(numa.get_tag_peak(AllocTag::kStreaming) == hard);
+}
+
+TEST_CASE("ScratchSpace: A full stack chains overflow blocks and recycles them after a flush", "[Extensions]")
+{
+	constexpr size_t kBlockSize = 16 * KB;
+	constexpr size_t kChunk = 4 * KB;
+	constexpr size_t kChunks = 40;
+
+	StackAllocator scratch(kBlockSize, MemoryMappingType::kCPU);
+
+	std::vector<uint8_t*> chunks;
+	for (size_t i = 0; i < kChunks; ++i)
+	{
+		uint8_t* p = static_cast<uint8_t*>(scratch.allocate(kChunk, 16));
+		REQUIRE(p != nullptr);
+		REQUIRE(scratch.owns(p));
+		REQUIRE(is_within_mapped_block(p, MemoryMappingType::kCPU));
+		memset(p, (int)i, kChunk);
+		chunks.push_back(p);
+	}
+	REQUIRE(scratch.get_overflow_count() == kChunks - kBlockSize / kChunk);
+	REQUIRE(scratch.get_overflow_bytes() == (kChunks - kBlockSize / kChunk) * kChunk);
+	// nothing overlaps
+	for (size_t i = 0; i < kChunks; ++i)
+	{
+		REQUIRE(chunks[i][0] == (uint8_t)i);
+		REQUIRE(chunks[i][kChunk - 1] == (uint8_t)i);
+	}
+
+	// a flush keeps the overflow blocks spare, the same run again needs nothing new from the system
+	scratch.handle_signals(GameEventType::kEventFlushScratchSpace);
+	systemBrokerStats before = get_system_broker_stats();
+	for (size_t i = 0; i < kChunks; ++i)
+		REQUIRE(scratch.allocate(kChunk, 16) != nullptr);
+	REQUIRE(get_system_broker_stats().regionCount == before.regionCount);
+	REQUIRE(get_system_broker_stats().regionBytes == before.regionBytes);
+
+	// the overflow bytes are charged like any other
+	REQUIRE(scratch.get_tag_usage(AllocTag::kUntagged) == kChunks * kChunk);
+	scratch.handle_signals(GameEventType::kEventFlushScratchSpace);
+	REQUIRE(scratch.get_tag_usage(AllocTag::kUntagged) == 0);
+}
+
+TEST_CASE("SingleFrameCPU: Ring overflow lives one more wrap before it goes back", "[Extensions]")
+{
+	constexpr size_t kBlockSize = 8 * KB;
+
+	MultiFrameAllocator frames(kBlockSize, MemoryMappingType::kCPU);
+	uint8_t* overflow = nullptr;
+	while (!overflow)
+	{
+		uint8_t* p = static_cast<uint8_t*>(frames.allocate(1 * KB, 16));
+		REQUIRE(p != nullptr);
+		if (frames.get_overflow_count())
+			overflow = p;
+	}
+	memset(overflow, 0x42, 1 * KB);
+
+	// the ring wraps after four frames - overflow from before it may still be read
+	for (int frame = 0; frame < 4; ++frame)
+		frames.handle_signals(GameEventType::kEventNextFrame);
+	REQUIRE(frames.owns(overflow));
+	REQUIRE(overflow[1 * KB - 1] == 0x42);
+	REQUIRE(frames.get_tag_usage(AllocTag::kUntagged) == 0);
+
+	// still owned after the next wrap, but only as a spare block to chain again
+	uint8_t* reuse = nullptr;
+	for (int frame = 0; frame < 4; ++frame)
+		frames.handle_signals(GameEventType::kEventNextFrame);
+	for (int i = 0; i < 16 && !reuse; ++i)
+	{
+		uint8_t* p = static_cast<uint8_t*>(frames.allocate(1 * KB, 16));
+		if (p == overflow)
+			reuse = p;
+	}
+	REQUIRE(reuse == overflow);
+}
+
+TEST_CASE("GeneralHeap: Combinators route allocations and releases to the right allocator", "[Extensions]")
+{
+	constexpr size_t kPack = sizeof(ObjectPoolManager::dataPack);
+
+	ObjectPoolManager pool(4, MemoryMappingType::kCPU, 4);
+	StackAllocator stack(64 * KB, MemoryMappingType::kCPU);
+
+	SECTION("fallback takes what the primary cant")
+	{
+		FallbackAllocator fallback(&pool, &stack);
+
+		// too big, or too aligned, for a pack
+		void* big = fallback.allocate(kPack + 1, 16);
+		void* aligned = fallback.allocate(16, 128);
+		REQUIRE(stack.owns(big));
+		REQUIRE(stack.owns(aligned));
+		REQUIRE(is_aligned(aligned, 128));
+
+		void* small = fallback.allocate(16, 16);
+		REQUIRE(pool.owns(small));
+		REQUIRE(fallback.owns(small));
+		REQUIRE(fallback.get_bytes_in_use() == pool.get_bytes_in_use() + stack.get_bytes_in_use());
+
+		fallback.release(small);
+		REQUIRE(pool.get_live_count() == 0);
+		// the stack pops its newest
+		fallback.release_sized(aligned, 16, 128);
+		REQUIRE(stack.get_bytes_in_use() == kPack + 1);
+	}
+
+	SECTION("segregator splits on size, release_sized routes without asking")
+	{
+		SegregatorAllocator segregator(kPack, &pool, &stack);
+
+		void* small = segregator.allocate(kPack, 16);
+		void* large = segregator.allocate(kPack + 1, 16);
+		REQUIRE(pool.owns(small));
+		REQUIRE(stack.owns(large));
+
+		segregator.release_sized(large, kPack + 1, 16);
+		REQUIRE(stack.get_bytes_in_use() == 0);
+		segregator.release(small);
+		REQUIRE(pool.get_live_count() == 0);
+
+		// growing across the threshold has to move
+		small = segregator.allocate(16, 16);
+		REQUIRE(segregator.try_expand(small, kPack));
+		REQUIRE(!segregator.try_expand(small, kPack + 1));
+	}
+
+	SECTION("bucketizer picks the first bucket that fits")
+	{
+		StackAllocator large(64 * KB, MemoryMappingType::kCPU);
+		BucketizerAllocator buckets;
+		buckets.add_bucket(kPack, &pool);
+		buckets.add_bucket(1 * KB, &stack);
+		buckets.add_bucket(32 * KB, &large);
+
+		void* a = buckets.allocate(kPack, 16);
+		void* b = buckets.allocate(kPack + 1, 16);
+		void* c = buckets.allocate(1 * KB + 1, 16);
+		REQUIRE(pool.owns(a));
+		REQUIRE(stack.owns(b));
+		REQUIRE(large.owns(c));
+		REQUIRE(buckets.allocate(32 * KB + 1, 16) == nullptr);
+
+		buckets.release(a);
+		REQUIRE(pool.get_live_count() == 0);
+		buckets.release_sized(c, 1 * KB + 1, 16);
+		REQUIRE(large.get_bytes_in_use() == 0);
+		buckets.release_sized(b, kPack + 1, 16);
+		REQUIRE(stack.get_bytes_in_use() == 0);
+	}
+
+	SECTION("affix guards catch overruns and underruns")
+	{
+		AffixAllocator affix(&stack);
+
+		uint8_t* p = static_cast<uint8_t*>(affix.allocate(100, 64));
+		REQUIRE(p != nullptr);
+		REQUIRE(is_aligned(p, 64));
+		memset(p, 0, 100);
+		REQUIRE(affix.check_guards(p));
+
+		p[100] = 0;
+		REQUIRE(!affix.check_guards(p));
+		p[100] = AffixAllocator::kGuardByte;
+		REQUIRE(affix.check_guards(p));
+
+		// into the guard in front of the header
+		uint8_t* header = p - sizeof(AffixAllocator::affixHeader);
+		header[-1] = 0;
+		REQUIRE(!affix.check_guards(p));
+		header[-1] = AffixAllocator::kGuardByte;
+
+		// into the header itself
+		uint32_t magic = reinterpret_cast<AffixAllocator::affixHeader*>(header)->magic;
+		reinterpret_cast<AffixAllocator::affixHeader*>(header)->magic = 0;
+		REQUIRE(!affix.check_guards(p));
+		reinterpret_cast<AffixAllocator::affixHeader*>(header)->magic = magic;
+
+		// growing moves the suffix guard out with it
+		REQUIRE(affix.try_expand(p, 200));
+		REQUIRE(affix.check_guards(p));
+		p[199] = 1;
+		REQUIRE(affix.check_guards(p));
+		affix.release_sized(p, 200, 64);
+		REQUIRE(stack.get_bytes_in_use() == 0);
+	}
+}
+
+TEST_CASE("GeneralHeap: Guarded sampling puts samples against a guard page", "[Extensions]")
+{
+	StackAllocator parent(256 * KB, MemoryMappingType::kCPU);
+
+	SECTION("a rate of 0 is off")
+	{
+		GuardedSamplingAllocator guarded(&parent, 0);
+		for (int i = 0; i < 1000; ++i)
+			REQUIRE(parent.owns(guarded.allocate(16, 16)));
+		REQUIRE(guarded.get_sampled_count() == 0);
+	}
+
+	SECTION("samples end on the guard page and the rest go to the parent")
+	{
+		constexpr int kAllocs = 200;
+		constexpr uint32_t kRate = 4;
+		GuardedSamplingAllocator guarded(&parent, kRate);
+
+		std::vector<uint8_t*> sampled;
+		for (int i = 0; i < kAllocs; ++i)
+		{
+			uint8_t* p = static_cast<uint8_t*>(guarded.allocate(24, 8));
+			REQUIRE(p != nullptr);
+			REQUIRE(guarded.owns(p));
+			memset(p, 0x33, 24);
+			if (!parent.owns(p))
+				sampled.push_back(p);
+		}
+		// rate on average, and never more than the slots
+		REQUIRE(guarded.get_sampled_count() == sampled.size());
+		REQUIRE(sampled.size() >= kAllocs / (4 * kRate));
+		REQUIRE(sampled.size() <= GuardedSamplingAllocator::kMaxGuardedSlots);
+		for (uint8_t* p : sampled)
+			REQUIRE(is_aligned(p + 24, 4 * KB));
+
+		// a touch just past the end is in a guard page - reported as an overrun of the live sample
+		REQUIRE(guarded.report_fault(sampled[0] + 24));
+		REQUIRE(!guarded.report_fault(parent.get_memblock()));
+
+		REQUIRE(guarded.get_bytes_in_use() == parent.get_bytes_in_use() + sampled.size() * 24);
+		for (uint8_t* p : sampled)
+			guarded.release(p);
+		REQUIRE(guarded.get_bytes_in_use() == parent.get_bytes_in_use());
+	}
+
+	SECTION("anything bigger than a page is never sampled")
+	{
+		GuardedSamplingAllocator guarded(&parent, 1);
+		for (int i = 0; i < 10; ++i)
+			REQUIRE(parent.owns(guarded.allocate(8 * KB, 16)));
+		REQUIRE(guarded.get_sampled_count() == 0);
+	}
+}
+
+static size_t count_heap_profile(const IMemoryAllocatorX& allocator, size_t& inuseCount, size_t& inuseBytes)
+{
+	std::vector<IMemoryAllocatorX::heapStackStats> stacks;
+	allocator.gather_heap_profile(stacks);
+	size_t allocCount = 0;
+	inuseCount = inuseBytes = 0;
+	for (const IMemoryAllocatorX::heapStackStats& s : stacks)
+	{
+		REQUIRE(s.frameCount > 0);
+		REQUIRE(s.inuseCount <= s.allocCount);
+		allocCount += s.allocCount;
+		inuseCount += s.inuseCount;
+		inuseBytes += s.inuseBytes;
+	}
+	return allocCount;
+}
+
+TEST_CASE("SmallObject: Heap profiles sample live allocations and dump in pprof's format", "[Extensions]")
+{
+	constexpr size_t kPack = sizeof(ObjectPoolManager::dataPack);
+	constexpr size_t kAllocs = 200;
+	const char* kProfile = "extension_test.heap";
+
+	ObjectPoolManager pool(kAllocs, MemoryMappingType::kCPU);
+	REQUIRE(!pool.dump_heap_profile(kProfile));
+
+	// an interval of a pack samples most of them
+	pool.enable_heap_profile(kPack);
+	std::vector<void*> allocs;
+	for (size_t i = 0; i < kAllocs; ++i)
+		allocs.push_back(pool.allocate(32, 16));
+
+	size_t inuseCount, inuseBytes;
+	size_t sampled = count_heap_profile(pool, inuseCount, inuseBytes);
+	REQUIRE(sampled > kAllocs / 4);
+	REQUIRE(sampled <= kAllocs);
+	REQUIRE(inuseCount == sampled);
+	REQUIRE(inuseBytes == sampled * kPack);
+
+	for (void* p : allocs)
+		pool.release(p);
+	REQUIRE(count_heap_profile(pool, inuseCount, inuseBytes) == sampled);
+	REQUIRE(inuseCount == 0);
+
+	REQUIRE(pool.dump_heap_profile(kProfile));
+	std::ifstream profile(kProfile);
+	std::string line;
+	REQUIRE(std::getline(profile, line));
+	REQUIRE(line == "heap profile: 0: 0 [" + std::to_string(sampled) + ": " + std::to_string(sampled * kPack) + "] @ heap_v2/" + std::to_string(kPack));
+	REQUIRE(std::getline(profile, line));
+	REQUIRE(line.find("0: 0 [") == 0);
+	REQUIRE(line.find("] @ 0x") != std::string::npos);
+	profile.close();
+	remove(kProfile);
+}
+
+TEST_CASE("ScratchSpace: A flush drops every heap profile sample", "[Extensions]")
+{
+	StackAllocator scratch(64 * KB, MemoryMappingType::kCPU);
+	scratch.enable_heap_profile(64);
+	for (int i = 0; i < 100; ++i)
+		scratch.allocate(128, 16);
+
+	size_t inuseCount, inuseBytes;
+	REQUIRE(count_heap_profile(scratch, inuseCount, inuseBytes) > 0);
+	REQUIRE(inuseCount > 0);
+
+	scratch.handle_signals(GameEventType::kEventFlushScratchSpace);
+	count_heap_profile(scratch, inuseCount, inuseBytes);
+	REQUIRE(inuseCount == 0);
+	REQUIRE(inuseBytes == 0);
+}
+
+static size_t count_occurrences(const std::string& text, const std::string& needle)
+{
+	size_t count = 0;
+	for (size_t at = text.find(needle); at != std::string::npos; at = text.find(needle, at + needle.size()))
+		++count;
+	return count;
+}
+
+TEST_CASE("Trace Export: Events land in a well formed trace file", "[Extensions]")
+{
+	const char* kTrace = "extension_test_trace.json";
+
+	// the harness only traces when TRACE_EXPORT_ON is set
+	REQUIRE(!trace_is_open());
+	trace_instant("BeforeOpen");
+
+	{
+		// opened mid slice - dropped rather than written with a bogus start
+		ScopedTraceSlice early("EarlySlice");
+		REQUIRE(trace_open(kTrace));
+		REQUIRE(!trace_open(kTrace));
+	}
+
+	trace_counter("TestTrack", 4096);
+	trace_instant("TestInstant");
+	{
+		ScopedTraceSlice slice("TestSlice");
+	}
+	trace_close();
+	REQUIRE(!trace_is_open());
+	trace_instant("AfterClose");
+
+	std::ifstream file(kTrace);
+	std::string trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	file.close();
+	remove(kTrace);
+
+	REQUIRE(trace.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n") == 0);
+	REQUIRE(trace.size() >= 4);
+	REQUIRE(trace.compare(trace.size() - 4, 4, "\n]}\n") == 0);
+
+	REQUIRE(count_occurrences(trace, "{\"name\":") == 3);
+	REQUIRE(count_occurrences(trace, "},\n{") == 2);
+	REQUIRE(trace.find("{\"name\":\"TestTrack\",\"ph\":\"C\",") != std::string::npos);
+	REQUIRE(trace.find("\"args\":{\"bytes\":4096}}") != std::string::npos);
+	REQUIRE(trace.find("{\"name\":\"TestInstant\",\"ph\":\"i\",\"s\":\"g\",") != std::string::npos);
+	REQUIRE(trace.find("{\"name\":\"TestSlice\",\"ph\":\"X\",") != std::string::npos);
+	REQUIRE(trace.find("\"dur\":") != std::string::npos);
+	REQUIRE(trace.find("BeforeOpen") == std::string::npos);
+	REQUIRE(trace.find("EarlySlice") == std::string::npos);
+	REQUIRE(trace.find("AfterClose") == std::string::npos);
+}
+
+TEST_CASE("SmallObject: Fragmentation stats and layout snapshots follow the free packs", "[Extensions]")
+{
+	constexpr size_t kPack = sizeof(ObjectPoolManager::dataPack);
+	constexpr size_t kSlots = 64;
+	const char* kSnapshot = "extension_test.mlay";
+
+	ObjectPoolManager pool(kSlots, MemoryMappingType::kCPU);
+	std::vector<void*> allocs;
+	for (size_t i = 0; i < 10; ++i)
+		allocs.push_back(pool.allocate(32, 16));
+	for (size_t i = 1; i < 8; i += 2)
+		pool.release(allocs[i]);
+
+	// four single pack holes and the untouched tail
+	IMemoryAllocatorX::fragmentationStats stats;
+	pool.gather_fragmentation(stats);
+	REQUIRE(stats.freeExtentCount == 5);
+	REQUIRE(stats.freeBytes == (kSlots - 6) * kPack);
+	REQUIRE(stats.largestFreeExtent == (kSlots - 10) * kPack);
+	REQUIRE(stats.paddingBytes == 6 * (kPack - 32));
+
+	size_t packBucket = 0;
+	while ((kPack >> (packBucket + 1)) != 0)
+		++packBucket;
+	REQUIRE(stats.freeExtentHistogram[packBucket] == 4);
+
+	REQUIRE(pool.dump_layout_snapshot(kSnapshot));
+	std::ifstream file(kSnapshot, std::fstream::binary);
+	std::string snapshot((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	file.close();
+	remove(kSnapshot);
+
+	const size_t kHeader = 4 + 2 * sizeof(uint32_t);
+	const size_t kRegionHeader = 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+	REQUIRE(snapshot.size() == kHeader + kRegionHeader + kSlots);
+	REQUIRE(snapshot.compare(0, 4, "MLAY") == 0);
+
+	uint32_t version, regionCount, granule, granuleCount;
+	uint64_t base, size;
+	const char* at = snapshot.data() + 4;
+	memcpy(&version, at, sizeof(version)); at += sizeof(version);
+	memcpy(&regionCount, at, sizeof(regionCount)); at += sizeof(regionCount);
+	memcpy(&base, at, sizeof(base)); at += sizeof(base);
+	memcpy(&size, at, sizeof(size)); at += sizeof(size);
+	memcpy(&granule, at, sizeof(granule)); at += sizeof(granule);
+	memcpy(&granuleCount, at, sizeof(granuleCount)); at += sizeof(granuleCount);
+	REQUIRE(version == 1);
+	REQUIRE(regionCount == 1);
+	REQUIRE(base == reinterpret_cast<uintptr_t>(allocs[0]));
+	REQUIRE(size == kSlots * kPack);
+	REQUIRE(granule == kPack);
+	REQUIRE(granuleCount == kSlots);
+	for (size_t i = 0; i < kSlots; ++i)
+		REQUIRE((uint8_t)at[i] == ((i < 10 && (i % 2 == 0 || i > 7)) ? 255 : 0));
+
+	for (size_t i = 0; i < 10; ++i)
+	{
+		if (i % 2 == 0 || i > 7)
+			pool.release(allocs[i]);
+	}
+}
+
+TEST_CASE("ScratchSpace: Fragmentation stats count alignment padding and the free top", "[Extensions]")
+{
+	constexpr size_t kSize = 64 * KB;
+	StackAllocator scratch(kSize, MemoryMappingType::kCPU);
+	uint8_t* a = (uint8_t*)scratch.allocate(100, 64);
+	uint8_t* b = (uint8_t*)scratch.allocate(100, 64);
+	uint8_t* c = (uint8_t*)scratch.allocate(100, 64);
+
+	IMemoryAllocatorX::fragmentationStats stats;
+	scratch.gather_fragmentation(stats);
+	REQUIRE(stats.freeExtentCount == 1);
+	REQUIRE(stats.largestFreeExtent == stats.freeBytes);
+	REQUIRE(stats.paddingBytes == (size_t)(b - (a + 100)) + (size_t)(c - (b + 100)));
+	REQUIRE(stats.freeBytes == kSize - (size_t)(scratch.get_memLoc() - scratch.get_memblock()));
+
+	std::vector<IMemoryAllocatorX::layoutRegion> regions;
+	scratch.gather_layout(regions);
+	REQUIRE(regions.size() == 1);
+	REQUIRE(regions[0].base == scratch.get_memblock());
+	REQUIRE(regions[0].size == kSize);
+	// a few hundred bytes of the first granule
+	REQUIRE(regions[0].occupancy.front() > 0);
+	REQUIRE(regions[0].occupancy.front() < 255);
+	REQUIRE(regions[0].occupancy.back() == 0);
+}
+
+TEST_CASE("ScratchSpace: Reallocate grows the top in place and moves everything else", "[Extensions]")
+{
+	ScopedAllocTag tag(AllocTag::kRender);
+	StackAllocator scratch(64 * KB, MemoryMappingType::kCPU);
+	uint8_t* a = (uint8_t*)scratch.allocate(64, 16);
+	memset(a, 0xA1, 64);
+	uint8_t* b = (uint8_t*)scratch.allocate(64, 16);
+
+	// the top grows into the free space behind it
+	REQUIRE(scratch.reallocate(b, 64, 256, 16) == b);
+	REQUIRE(scratch.get_memLoc() == b + 256);
+	REQUIRE(scratch.get_tag_usage(AllocTag::kRender) == 64 + 256);
+	REQUIRE(scratch.try_expand(b, 128));
+	REQUIRE(scratch.get_memLoc() == b + 256);
+
+	// anything below it has to move
+	REQUIRE(!scratch.try_expand(a, 128));
+	uint8_t* c = (uint8_t*)scratch.reallocate(a, 64, 128, 16);
+	REQUIRE(c != a);
+	REQUIRE(c >= b + 256);
+	REQUIRE(c[0] == 0xA1);
+	REQUIRE(c[63] == 0xA1);
+
+	// grown then popped - the whole charge comes back, leaving only a until the stack resets
+	scratch.release_sized(c, 128, 16);
+	scratch.release_sized(b, 256, 16);
+	REQUIRE(scratch.get_memLoc() == b);
+	REQUIRE(scratch.get_tag_usage(AllocTag::kRender) == 64);
+}
+
+static size_t pool_padding(const ObjectPoolManager& pool)
+{
+	IMemoryAllocatorX::fragmentationStats stats;
+	pool.gather_fragmentation(stats);
+	return stats.paddingBytes;
+}
+
+TEST_CASE("SmallObject: Reallocate stays in the pack until it outgrows it", "[Extensions]")
+{
+	constexpr size_t kPack = sizeof(ObjectPoolManager::dataPack);
+	ObjectPoolManager pool(16, MemoryMappingType::kCPU);
+	uint8_t* p = (uint8_t*)pool.allocate(16, 16);
+	memset(p, 0xB2, 16);
+	REQUIRE(pool_padding(pool) == kPack - 16);
+
+	REQUIRE(pool.reallocate(p, 16, kPack, 16) == p);
+	REQUIRE(pool_padding(pool) == 0);
+	REQUIRE(pool.reallocate(p, kPack, 8, 16) == p);
+	REQUIRE(pool_padding(pool) == kPack - 8);
+
+	// the pool wont take anything bigger than a pack - ptr is left alone
+	REQUIRE(pool.reallocate(p, 8, kPack + 1, 16) == nullptr);
+	REQUIRE(p[0] == 0xB2);
+	REQUIRE(pool_padding(pool) == kPack - 8);
+	pool.release(p);
+}
+
+TEST_CASE("GeneralHeap: Reallocate keeps contents and tag charges right", "[Extensions]")
+{
+	ScopedAllocTag tag(AllocTag::kRender);
+	AlignedMallocAllocator heap;
+	uint8_t* p = (uint8_t*)heap.reallocate(nullptr, 0, 100, 16);
+	REQUIRE(p != nullptr);
+	for (int i = 0; i < 100; ++i)
+		p[i] = (uint8_t)i;
+	REQUIRE(heap.get_tag_usage(AllocTag::kRender) == 100);
+
+	// shrinking always works in place
+	REQUIRE(heap.try_expand(p, 40));
+	REQUIRE(heap.get_tag_usage(AllocTag::kRender) == 40);
+
+	uint8_t* q = (uint8_t*)heap.reallocate(p, 40, 64 * KB, 64);
+	REQUIRE(q != nullptr);
+	REQUIRE(((uintptr_t)q & 63) == 0);
+	for (int i = 0; i < 40; ++i)
+		REQUIRE(q[i] == (uint8_t)i);
+	REQUIRE(heap.get_tag_usage(AllocTag::kRender) == 64 * KB);
+
+	heap.release(q);
+	REQUIRE(heap.get_tag_usage(AllocTag::kRender) == 0);
+}
+
+TEST_CASE("Level Streaming: A manifest streams into the arena in chunks", "[Extensions]")
+{
+	const char* kLevelFile = "extension_test.level";
+	const size_t kFileSize = 3 * LevelStreamer::kChunkSize + 12345;
+	std::vector<uint8_t> contents(kFileSize);
+	for (size_t i = 0; i < kFileSize; ++i)
+		contents[i] = (uint8_t)(i * 31 + (i >> 12));
+	{
+		std::ofstream file(kLevelFile, std::fstream::binary | std::fstream::trunc);
+		file.write((const char*)contents.data(), contents.size());
+	}
+
+	StackAllocator arena(8 * MB, MemoryMappingType::kGPU);
+	LevelStreamer streamer(&arena, 3);
+
+	SECTION("every entry lands at its reserved, aligned spot")
+	{
+		LevelStreamer::manifestEntry entries[] = {
+			{ kLevelFile, 0, kFileSize, 4096, nullptr },
+			{ kLevelFile, 1000, 5000, 64, nullptr },
+			{ kLevelFile, kFileSize - 1, 1, 1, nullptr },
+		};
+		REQUIRE(streamer.begin_load(entries, 3));
+		REQUIRE(streamer.wait_complete());
+		REQUIRE(streamer.is_complete());
+		REQUIRE(streamer.get_bytes_read() == kFileSize + 5000 + 1);
+
+		REQUIRE(((uintptr_t)entries[0].dest & 4095) == 0);
+		REQUIRE(((uintptr_t)entries[1].dest & 63) == 0);
+		REQUIRE(arena.owns(entries[0].dest));
+		REQUIRE(memcmp(entries[0].dest, contents.data(), kFileSize) == 0);
+		REQUIRE(memcmp(entries[1].dest, contents.data() + 1000, 5000) == 0);
+		REQUIRE(*(uint8_t*)entries[2].dest == contents.back());
+	}
+
+	SECTION("a read past the end of the file fails the load")
+	{
+		LevelStreamer::manifestEntry entry = { kLevelFile, kFileSize - 100, 200, 16, nullptr };
+		REQUIRE(streamer.begin_load(&entry, 1));
+		REQUIRE(!streamer.wait_complete());
+	}
+
+	SECTION("a missing file fails before anything is read")
+	{
+		LevelStreamer::manifestEntry entry = { "extension_test_missing.level", 0, 100, 16, nullptr };
+		REQUIRE(!streamer.begin_load(&entry, 1));
+		REQUIRE(streamer.get_bytes_read() == 0);
+		REQUIRE(streamer.is_complete());
+	}
+
+	remove(kLevelFile);
+}
+
+TEST_CASE("Sizing Profile: Recorded high water marks size the next run", "[Extensions]")
+{
+	const char* kProfileFile = "extension_test.sizing";
+
+	SECTION("a missing profile falls back to the defaults")
+	{
+		SizingProfile profile(0.25f);
+		REQUIRE(!profile.load("extension_test_missing.sizing"));
+		REQUIRE(profile.get_entry_count() == 0);
+		REQUIRE(profile.get_size("LevelCPU", 12 * MB, 64 * KB) == 12 * MB);
+	}
+
+	SECTION("sizes are the high water plus the margin, rounded to the granule")
+	{
+		{
+			std::ofstream file(kProfileFile, std::ios::trunc);
+			file << "# hand written\n"
+				<< "\n"
+				<< "LevelCPU 1000000\n"
+				<< "SmallObjectSlots 300\n"
+				<< "Unused 0\n"
+				<< "broken line\n"
+				<< "LevelCPU 2000000\n";
+		}
+		SizingProfile profile(0.25f);
+		REQUIRE(profile.load(kProfileFile));
+
+		// later lines replace earlier ones, comments and junk are skipped
+		REQUIRE(profile.get_entry_count() == 3);
+		REQUIRE(profile.get_high_water("LevelCPU") == 2000000);
+		REQUIRE(profile.get_size("LevelCPU", 12 * MB, 64 * KB) == 2555904);
+		REQUIRE(profile.get_size("SmallObjectSlots", 8192, 64) == 384);
+		REQUIRE(profile.get_size("SmallObjectSlots", 8192) == 375);
+
+		// recorded as never used - no better than a guess
+		REQUIRE(profile.get_size("Unused", 4 * MB) == 4 * MB);
+		REQUIRE(profile.get_size("NotProfiled", 4 * MB) == 4 * MB);
+
+		profile.set_safety_margin(0.0f);
+		REQUIRE(profile.get_size("SmallObjectSlots", 8192) == 300);
+	}
+
+	SECTION("a saved profile loads back the same")
+	{
+		SizingProfile recorded;
+		recorded.record("ScratchSpace", 123456);
+		recorded.record("LevelGPU", 7 * MB);
+		REQUIRE(recorded.save(kProfileFile));
+
+		SizingProfile loaded;
+		REQUIRE(loaded.load(kProfileFile));
+		REQUIRE(loaded.get_entry_count() == 2);
+		REQUIRE(loaded.get_high_water("ScratchSpace") == 123456);
+		REQUIRE(loaded.get_high_water("LevelGPU") == 7 * MB);
+	}
+
+	remove(kProfileFile);
+}
@@ -1,22 +1,117 @@
 #include "AssignmentTestHarness.h"
 #include <fstream>
 #include <iomanip>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <algorithm>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#include <malloc.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#endif
+#include <cstdio>
 
 #define DATALOGGING_ON 1
 
+//diagnostics below cost time or memory on every run - off unless you are chasing something
+
+//sampled heap profile per allocator slot, written as heapprofile_<slot>.prof on shutdown
+#define HEAP_PROFILING_ON 0
+constexpr size_t kHeapProfileInterval = 512 * KB;
+
+//allocator activity on a frame timeline, written to allocator_trace.json
+#define TRACE_EXPORT_ON 0
+
+//block layout per allocator slot, written as layout_<slot>.bin on shutdown for heat maps
+#define LAYOUT_SNAPSHOT_ON 0
+
+//one in roughly this many GeneralHeap / SmallObject allocations gets guard pages
+#define GUARDED_SAMPLING_ON 0
+constexpr uint32_t kGuardedSampleRate = 1000;
+
+//a stand in GPU thread retiring SingleFrameGPU fences late, LevelGPU releases held until it is done with them,
+//and level streaming / upload worker threads. Off, every fence completes as it is signalled, LevelGPU releases
+//go straight to the rollback stack and uploads are copied on the signalling thread
+#define ASYNC_GPU_ON 0
+
+//SingleFrameGPU fences complete this long after the frame ends, plus up to the jitter
+constexpr uint32_t kSimulatedGpuLatencyUs = 200;
+constexpr uint32_t kSimulatedGpuJitterUs = 800;
+
+//LevelGPU releases are handed back this many frames later at the earliest
+constexpr uint32_t kDeferredReleaseFrames = 2;
+
+//allocator sizes come from allocator_sizing.txt when there is one - built in sizes otherwise
+#define SIZING_PROFILE_ON 1
+//write this run's high water marks to allocator_sizing.txt on shutdown
+#define SIZING_PROFILE_RECORD_ON 0
+constexpr const char* kSizingProfileFile = "allocator_sizing.txt";
+//headroom over the recorded high water, for runs that go a bit further than the recorded one
+constexpr float kSizingSafetyMargin = 0.25f;
+
 AssignmentTestHarness::AssignmentTestHarness()
 {
 	// TODO: any setup or initialization here.
-	m_pStackAllocator = new StackAllocator(32 * MB, MemoryMappingType::kUndefined);
-	m_pCPUMFAllocator = new MultiFrameAllocator(159 * KB, MemoryMappingType::kCPU);
-	m_pGPUMFAllocator = new MultiFrameAllocator(159 * KB, MemoryMappingType::kGPU);
+	//built in sizes are what the unit tests were measured to need - a recorded profile replaces them
+	SizingProfile sizing(kSizingSafetyMargin);
+#if SIZING_PROFILE_ON == 1
+	sizing.load(kSizingProfileFile);
+#endif
+	//per node instances are made later, so the factories carry their own sizes
+	size_t scratchSpaceSize = sizing.get_size("ScratchSpace", 32 * MB, kSystemRegionAlignment);
+	size_t smallObjectSlots = sizing.get_size("SmallObjectSlots", 4096 * 2, 64);
+
+	m_pStackAllocator = new NumaLocalAllocator([scratchSpaceSize]() -> StackAllocator* { return new StackAllocator(scratchSpaceSize, MemoryMappingType::kUndefined); });
+#if TRACE_EXPORT_ON == 1
+	//open first so the initial block acquisitions show up
+	trace_open("allocator_trace.json");
+#endif
+	m_pCPUMFAllocator = new MultiFrameAllocator(sizing.get_size("SingleFrameCPU", 159 * KB, kSystemRegionAlignment), MemoryMappingType::kCPU);
+	//SingleFrame data is read for up to three frames after it is made, on top of whatever the GPU lags
+#if ASYNC_GPU_ON == 1
+	m_pGpuTimeline = new SimulatedGpuTimeline(kSimulatedGpuLatencyUs, kSimulatedGpuJitterUs);
+#else
+	m_pGpuTimeline = new ImmediateFenceTimeline;
+#endif
+	m_pGPURing = new FencedRingAllocator(sizing.get_size("SingleFrameGPU", 320 * KB, kSystemRegionAlignment), MemoryMappingType::kGPU, m_pGpuTimeline, 3);
 
 	//level tests
-	m_pCPULevelStack = new StackAllocator(10 * KB, MemoryMappingType::kCPU);
-	m_pRollbackGPU = new RollbackStackAllocator(156 * MB, MemoryMappingType::kGPU);
+	m_pCPULevelStack = new StackAllocator(sizing.get_size("LevelCPU", 10 * KB, kSystemRegionAlignment), MemoryMappingType::kCPU);
+	m_pRollbackGPU = new RollbackStackAllocator(sizing.get_size("LevelGPU", 156 * MB, kSystemRegionAlignment), MemoryMappingType::kGPU);
+#if ASYNC_GPU_ON == 1
+	m_pLevelStreamer = new LevelStreamer(m_pRollbackGPU);
+	m_pDeferredLevelGPU = new DeferredReleaseAllocator(m_pRollbackGPU, kDeferredReleaseFrames, m_pGpuTimeline);
+	m_pUploadStager = new UploadStager(true);
+#else
+	m_pUploadStager = new UploadStager(false);
+#endif
 
 	//OBJECT POOL
-	m_pSmallObjectPool = new ObjectPoolManager(4096 * 2, MemoryMappingType::kUndefined);
+	m_pSmallObjectPool = new NumaLocalAllocator([smallObjectSlots]() -> StackAllocator* { return new ObjectPoolManager(smallObjectSlots, MemoryMappingType::kUndefined); });
+	m_pSmallObjectRouter = new SegregatorAllocator(sizeof(ObjectPoolManager::dataPack), m_pSmallObjectPool, &m_smallObjectOverflow);
 
 	// TODO: request any system allocations you intend on subdividing.
 	// Note: done by the allocator
@@ -26,13 +121,43 @@ AssignmentTestHarness::AssignmentTestHarness()
 	// Here is an example...
 	// NOTE THAT THIS WILL FAIL MANY TESTS
 	m_memAllocSet.GeneralHeap = &m_alignedMalloc;
-	m_memAllocSet.SmallObject = m_pSmallObjectPool;	
+	m_memAllocSet.SmallObject = m_pSmallObjectRouter;
 	m_memAllocSet.ScratchSpace = m_pStackAllocator;
 	m_memAllocSet.SingleFrameCPU = m_pCPUMFAllocator;
-	m_memAllocSet.SingleFrameGPU = m_pGPUMFAllocator;
+	m_memAllocSet.SingleFrameGPU = m_pGPURing;
 	m_memAllocSet.LevelCPU = m_pCPULevelStack;
+#if ASYNC_GPU_ON == 1
+	m_memAllocSet.LevelGPU = m_pDeferredLevelGPU;
+#else
 	m_memAllocSet.LevelGPU = m_pRollbackGPU;
+#endif
+
+#if GUARDED_SAMPLING_ON == 1
+	m_pGuardedGeneralHeap = new GuardedSamplingAllocator(&m_alignedMalloc, kGuardedSampleRate);
+	m_pGuardedSmallObject = new GuardedSamplingAllocator(m_pSmallObjectRouter, kGuardedSampleRate);
+	m_memAllocSet.GeneralHeap = m_pGuardedGeneralHeap;
+	m_memAllocSet.SmallObject = m_pGuardedSmallObject;
+#endif
+
+#if HEAP_PROFILING_ON == 1
+	for (IMemoryAllocator* slot : { m_memAllocSet.GeneralHeap, m_memAllocSet.SmallObject, m_memAllocSet.ScratchSpace, m_memAllocSet.SingleFrameCPU,
+		m_memAllocSet.SingleFrameGPU, m_memAllocSet.LevelCPU, m_memAllocSet.LevelGPU })
+	{
+		static_cast<IMemoryAllocatorX*>(slot)->enable_heap_profile(kHeapProfileInterval);
+	}
+#endif
 	set_allocators(m_memAllocSet);
+	subscribe_lifetime_events();
+
+#if PMR_ADAPTERS_ON == 1
+	m_memResourceSet.GeneralHeap = new AllocatorResource(static_cast<IMemoryAllocatorX*>(m_memAllocSet.GeneralHeap));
+	m_memResourceSet.SmallObject = new AllocatorResource(static_cast<IMemoryAllocatorX*>(m_memAllocSet.SmallObject));
+	m_memResourceSet.ScratchSpace = new StackResource<NumaLocalAllocator>(m_pStackAllocator);
+	m_memResourceSet.SingleFrameCPU = new StackResource<MultiFrameAllocator>(m_pCPUMFAllocator);
+	m_memResourceSet.SingleFrameGPU = new StackResource<FencedRingAllocator>(m_pGPURing);
+	m_memResourceSet.LevelCPU = new StackResource<StackAllocator>(m_pCPULevelStack);
+	m_memResourceSet.LevelGPU = new AllocatorResource(static_cast<IMemoryAllocatorX*>(m_memAllocSet.LevelGPU));
+#endif
 
 
 }
@@ -42,39 +167,154 @@ void AssignmentTestHarness::signal(GameEventType evt)
 	// NOTE: Unit tests will call this function with a variety of useful signals.
 	// By intercepting them you can tailor your memory system behavior accordingly.
 	// In many tests, allocated memory is need for only a small number of frames or a a specific period of time.
-	switch (evt)
-	{
-	case GameEventType::kEventFlushScratchSpace:	// signaled when a system has finished with scratch memory.
-		reinterpret_cast<IMemoryAllocatorX*>(m_memAllocSet.ScratchSpace)->handle_signals((int)GameEventType::kEventFlushScratchSpace);
-		break;
-	case GameEventType::kEventGameInit:
-		break;
-	case GameEventType::kEventLevelBeginLoad:		// signaled when a "level" begins to load.
-		reinterpret_cast<IMemoryAllocatorX*>(m_memAllocSet.LevelGPU)->handle_signals((int)GameEventType::kEventLevelBeginLoad);
-	case GameEventType::kEventLevelLoadComplete:	// signaled when "level" loading is complete.
-		break;
-	case GameEventType::kEventLevelUnload:
-		reinterpret_cast<IMemoryAllocatorX*>(m_memAllocSet.LevelGPU)->handle_signals((int)GameEventType::kEventLevelUnload);
-		break;
-	case GameEventType::kEventGameShutdown:
-		break;
-	case GameEventType::kEventNextFrame:			// signaled when a frame is finished
-		reinterpret_cast<IMemoryAllocatorX*>(m_memAllocSet.SingleFrameCPU)->handle_signals((int)GameEventType::kEventNextFrame);
-		reinterpret_cast<IMemoryAllocatorX*>(m_memAllocSet.SingleFrameGPU)->handle_signals((int)GameEventType::kEventNextFrame);
-		break;
-	}
+#if TRACE_EXPORT_ON == 1
+	static const char* const kEventNames[(size_t)GameEventType::kMaxEventTypes] = {
+		"FlushScratchSpace", "GameInit", "LevelBeginLoad", "LevelLoadComplete", "LevelUnload", "GameShutdown", "NextFrame" };
+	trace_instant((size_t)evt < (size_t)GameEventType::kMaxEventTypes ? kEventNames[(size_t)evt] : "CustomLifetimeEvent");
+#endif
+
+	m_eventRegistry.dispatch(evt);
+
+#if TRACE_EXPORT_ON == 1
+	//sample every slot after the event has been handled
+	trace_slot_usage();
+#endif
+}
+
+void AssignmentTestHarness::subscribe_lifetime_events()
+{
+	//the allocators behind the slots - guarded samplers only pass signals through, so the router stands in for SmallObject
+	IMemoryAllocatorX* scratchSpace = m_pStackAllocator;
+	IMemoryAllocatorX* smallObject = m_pSmallObjectRouter;
+	IMemoryAllocatorX* singleFrameCPU = m_pCPUMFAllocator;
+	IMemoryAllocatorX* singleFrameGPU = m_pGPURing;
+	IMemoryAllocatorX* levelGPU = static_cast<IMemoryAllocatorX*>(m_memAllocSet.LevelGPU);
+
+	// signaled when a system has finished with scratch memory.
+	m_eventRegistry.subscribe_allocator(GameEventType::kEventFlushScratchSpace, LifetimeEventRegistry::kPriorityDefault, scratchSpace);
+
+	// signaled when a "level" begins to load.
+	m_eventRegistry.subscribe_allocator(GameEventType::kEventLevelBeginLoad, LifetimeEventRegistry::kPriorityDefault, levelGPU);
+
+	// signaled when "level" loading is complete - every streamed read and upload has to have landed before the level is used
+	if (m_pLevelStreamer)
+		m_eventRegistry.subscribe(GameEventType::kEventLevelLoadComplete, LifetimeEventRegistry::kPriorityFirst, [this](GameEventType) {
+			//a short or failed read leaves the level half loaded
+			bool loaded = m_pLevelStreamer->wait_complete();
+			SHU_ASSERT(loaded);
+		});
+	m_eventRegistry.subscribe(GameEventType::kEventLevelLoadComplete, LifetimeEventRegistry::kPriorityFirst, [this](GameEventType) {
+		m_pUploadStager->flush();
+		m_pUploadStager->wait_complete();
+	});
+
+	//reads and copies must not land in memory we are about to roll back
+	if (m_pLevelStreamer)
+		m_eventRegistry.subscribe(GameEventType::kEventLevelUnload, LifetimeEventRegistry::kPriorityFirst, [this](GameEventType) { m_pLevelStreamer->wait_complete(); });
+	m_eventRegistry.subscribe(GameEventType::kEventLevelUnload, LifetimeEventRegistry::kPriorityFirst, [this](GameEventType) { m_pUploadStager->wait_complete(); });
+	m_eventRegistry.subscribe_allocator(GameEventType::kEventLevelUnload, LifetimeEventRegistry::kPriorityDefault, levelGPU);
+	m_eventRegistry.subscribe_allocator(GameEventType::kEventLevelUnload, LifetimeEventRegistry::kPriorityDefault, smallObject);
+
+	// signaled when a frame is finished - this frame's uploads start first and have landed before
+	//SingleFrameCPU can wrap over their sources and before SingleFrameGPU signals the frame's fence
+	//(handlers at the same priority run in the order they subscribed).
+	//LevelGPU's deferred releases are checked after that fence is signalled
+	m_eventRegistry.subscribe(GameEventType::kEventNextFrame, LifetimeEventRegistry::kPriorityFirst, [this](GameEventType) { m_pUploadStager->flush(); });
+	m_eventRegistry.subscribe(GameEventType::kEventNextFrame, LifetimeEventRegistry::kPriorityDefault, [this](GameEventType) { m_pUploadStager->wait_complete(); });
+	m_eventRegistry.subscribe_allocator(GameEventType::kEventNextFrame, LifetimeEventRegistry::kPriorityDefault, singleFrameCPU);
+	m_eventRegistry.subscribe_allocator(GameEventType::kEventNextFrame, LifetimeEventRegistry::kPriorityDefault, singleFrameGPU);
+	m_eventRegistry.subscribe_allocator(GameEventType::kEventNextFrame, LifetimeEventRegistry::kPriorityLast, levelGPU);
+}
+
+void AssignmentTestHarness::trace_slot_usage()
+{
+	if (!trace_is_open())
+		return;
+
+	trace_counter("GeneralHeap", static_cast<IMemoryAllocatorX*>(m_memAllocSet.GeneralHeap)->get_bytes_in_use());
+	trace_counter("SmallObject", static_cast<IMemoryAllocatorX*>(m_memAllocSet.SmallObject)->get_bytes_in_use());
+	trace_counter("ScratchSpace", static_cast<IMemoryAllocatorX*>(m_memAllocSet.ScratchSpace)->get_bytes_in_use());
+	trace_counter("SingleFrameCPU", static_cast<IMemoryAllocatorX*>(m_memAllocSet.SingleFrameCPU)->get_bytes_in_use());
+	trace_counter("SingleFrameGPU", static_cast<IMemoryAllocatorX*>(m_memAllocSet.SingleFrameGPU)->get_bytes_in_use());
+	trace_counter("LevelCPU", static_cast<IMemoryAllocatorX*>(m_memAllocSet.LevelCPU)->get_bytes_in_use());
+	trace_counter("LevelGPU", static_cast<IMemoryAllocatorX*>(m_memAllocSet.LevelGPU)->get_bytes_in_use());
 }
 
 
 AssignmentTestHarness::~AssignmentTestHarness()
 {
 	// TODO: any tear down shutdown code here.
+#if SIZING_PROFILE_RECORD_ON == 1
+	//same names the constructor sizes by
+	SizingProfile highWater;
+	highWater.record("ScratchSpace", m_pStackAllocator->get_sizing_high_water());
+	highWater.record("SmallObjectSlots", m_pSmallObjectPool->get_sizing_high_water());
+	highWater.record("SingleFrameCPU", m_pCPUMFAllocator->get_sizing_high_water());
+	highWater.record("SingleFrameGPU", m_pGPURing->get_sizing_high_water());
+	highWater.record("LevelCPU", m_pCPULevelStack->get_sizing_high_water());
+	highWater.record("LevelGPU", m_pRollbackGPU->get_sizing_high_water());
+	highWater.save(kSizingProfileFile);
+#endif
+#if HEAP_PROFILING_ON == 1
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.GeneralHeap)->dump_heap_profile("heapprofile_GeneralHeap.prof");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.SmallObject)->dump_heap_profile("heapprofile_SmallObject.prof");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.ScratchSpace)->dump_heap_profile("heapprofile_ScratchSpace.prof");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.SingleFrameCPU)->dump_heap_profile("heapprofile_SingleFrameCPU.prof");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.SingleFrameGPU)->dump_heap_profile("heapprofile_SingleFrameGPU.prof");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.LevelCPU)->dump_heap_profile("heapprofile_LevelCPU.prof");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.LevelGPU)->dump_heap_profile("heapprofile_LevelGPU.prof");
+#endif
+#if LAYOUT_SNAPSHOT_ON == 1
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.GeneralHeap)->dump_layout_snapshot("layout_GeneralHeap.bin");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.SmallObject)->dump_layout_snapshot("layout_SmallObject.bin");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.ScratchSpace)->dump_layout_snapshot("layout_ScratchSpace.bin");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.SingleFrameCPU)->dump_layout_snapshot("layout_SingleFrameCPU.bin");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.SingleFrameGPU)->dump_layout_snapshot("layout_SingleFrameGPU.bin");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.LevelCPU)->dump_layout_snapshot("layout_LevelCPU.bin");
+	static_cast<IMemoryAllocatorX*>(m_memAllocSet.LevelGPU)->dump_layout_snapshot("layout_LevelGPU.bin");
+#endif
+
+#if PMR_ADAPTERS_ON == 1
+	delete m_memResourceSet.GeneralHeap;
+	delete m_memResourceSet.SmallObject;
+	delete m_memResourceSet.ScratchSpace;
+	delete m_memResourceSet.SingleFrameCPU;
+	delete m_memResourceSet.SingleFrameGPU;
+	delete m_memResourceSet.LevelCPU;
+	delete m_memResourceSet.LevelGPU;
+#endif
+
+	delete m_pUploadStager;
+	delete m_pLevelStreamer;
+	delete m_pDeferredLevelGPU;
 	delete m_pRollbackGPU;
 	delete m_pCPULevelStack;
-	delete m_pGPUMFAllocator;
+	delete m_pGPURing;
+	delete m_pGpuTimeline;
 	delete m_pCPUMFAllocator;
 	delete m_pStackAllocator;
+	delete m_pGuardedGeneralHeap;
+	delete m_pGuardedSmallObject;
+	delete m_pSmallObjectRouter;
 	delete m_pSmallObjectPool;
+
+#if DATALOGGING_ON == 1
+	//how far the super blocks went - every allocator's regions are back by now
+	systemBrokerStats broker = get_system_broker_stats();
+	std::ofstream datalog("datalog.csv", std::fstream::app);
+	datalog << "System Block Broker,\n"
+		<< "super blocks:," << broker.superBlockCount << ",\n"
+		<< "reserved:," << broker.reservedBytes << " B,\n"
+		<< "region peak:," << broker.peakRegionBytes << " B,\n"
+		<< "regions leaked:," << broker.regionCount << ",\n\n";
+	datalog.close();
+#endif
+	//every allocator is gone - the super blocks go back before the leak report
+	release_empty_super_blocks();
+
+#if TRACE_EXPORT_ON == 1
+	trace_close();
+#endif
 }
 
 //=====================================================
@@ -82,497 +322,2090 @@ AssignmentTestHarness::~AssignmentTestHarness()
 //=====================================================
 #pragma region CUSTOM ALLOCATOR IMPLEMENTATIONS
 
-#pragma region IMemoryAllocator Extended Base - Measurement Helpers
-void IMemoryAllocatorX::measure_usage(size_t size)
+#pragma region Stack Capture
+uint32_t capture_stack(void** frames, uint32_t maxFrames)
 {
-	maxSpaceUsed += size;
-	++maxNumActiveAllocations;
+#if defined(_WIN32)
+	return CaptureStackBackTrace(1, maxFrames, frames, nullptr);
+#elif defined(__linux__)
+	int n = backtrace(frames, (int)maxFrames);
+	return n > 0 ? (uint32_t)n : 0;
+#else
+	return 0;
+#endif
+}
+#pragma endregion
 
-	if (size > largestAllocation)
-		largestAllocation = size;
+#pragma region Page Helpers
+static size_t get_page_size()
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
 }
 
-void IMemoryAllocatorX::output_all_data(const char* cn)
+//bigger clears go round the cache - that much freshly zeroed memory wont all be read back soon
+constexpr size_t kStreamZeroThreshold = 256 * KB;
+
+static void zero_memory(void* dst, size_t size)
 {
-	//early out if we already have data
-	if (get_isDataOutputted())
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+	if (size >= kStreamZeroThreshold)
+	{
+#if defined(__AVX2__)
+		constexpr size_t kStreamWidth = 32;
+		const __m256i zero = _mm256_setzero_si256();
+#else
+		constexpr size_t kStreamWidth = 16;
+		const __m128i zero = _mm_setzero_si128();
+#endif
+		uint8_t* p = (uint8_t*)dst;
+		size_t head = (kStreamWidth - ((uintptr_t)p & (kStreamWidth - 1))) & (kStreamWidth - 1);
+		memset(p, 0, head);
+		p += head;
+		size -= head;
+
+		size_t body = size & ~(kStreamWidth - 1);
+		for (size_t i(0); i < body; i += kStreamWidth)
+		{
+#if defined(__AVX2__)
+			_mm256_stream_si256((__m256i*)(p + i), zero);
+#else
+			_mm_stream_si128((__m128i*)(p + i), zero);
+#endif
+		}
+		memset(p + body, 0, size - body);
+		_mm_sfence();
 		return;
+	}
+#endif
+	memset(dst, 0, size);
+}
+#pragma endregion
 
-	std::ofstream datalog("datalog.csv", std::fstream::app);
-	datalog << cn << ",\n"
-		<< "largest allocation:," << largestAllocation << " B,\n"
-		<< "max space used (active allocations):," << lastMaxSpaceUsed << " B," << (float)(lastMaxSpaceUsed / KB) << " KB," << (float)(lastMaxSpaceUsed / MB) << " MB,\n"
-		<< "max space used (all):," << maxSpaceUsed << " B," << (float)(maxSpaceUsed / KB) << " KB," << (float)(maxSpaceUsed / MB) << " MB,\n"
-		<< "max active allocations (active allocations):," << lastMaxNumActiveAllocations << ",\n"
-		<< "max active allocations (all):," << maxNumActiveAllocations << ",\n\n";
-	datalog.close();
+#pragma region Trace Export
+//one writer for the whole process - events can come from any thread
+static std::ofstream g_traceFile;
+static std::mutex g_traceMutex;
+static bool g_traceFirstEvent = true;
 
-	//set flag if this is the first data to be outputted
-	set_isDataOutputted();
+static int64_t trace_now_us()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
 }
 
-void IMemoryAllocatorX::set_maxSpaceUsed(size_t s)
+//small stable ids read better in the viewer than OS thread ids
+static uint32_t trace_thread_id()
 {
-	maxSpaceUsed = s;
+	static std::atomic<uint32_t> nextId(0);
+	static thread_local uint32_t id = nextId++;
+	return id;
 }
 
-void IMemoryAllocatorX::set_lastMaxSpaceUsed(size_t s)
+//caller holds g_traceMutex
+static void trace_begin_event()
 {
-	lastMaxSpaceUsed = s;
+	g_traceFile << (g_traceFirstEvent ? "\n" : ",\n");
+	g_traceFirstEvent = false;
 }
-#pragma endregion
-
-#pragma region Stack Allocator - ALL PURPOSE
-void* StackAllocator::allocate(size_t size, size_t alignment) {
 
-	//if no memory grabbed - get it
-	if (!get_memblock())
-	{
-		//TEST MEMORY SIZE
-		int blocksize = get_memorySize();
-		set_spaceRemaining(blocksize);
-		set_memblock((uint8_t*)allocate_system_block(blocksize, get_memoryType()));
+bool trace_open(const char* filename)
+{
+	std::lock_guard<std::mutex> lock(g_traceMutex);
+	if (g_traceFile.is_open())
+		return false;
 
-		reset_memory_loc();
-	}
+	g_traceFile.open(filename, std::fstream::trunc);
+	if (!g_traceFile)
+		return false;
 
-	size_t sR = get_spaceRemaining();
-	void* ret_p = nullptr;
+	g_traceFirstEvent = true;
+	g_traceFile << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	return true;
+}
 
-	//override the alignment?
-	//if (get_alignment_override() == false)
-	//{
-		//align the first element
-		void* pCur = (void*)get_memLoc();
-		ret_p = std::align(alignment, size, pCur, sR);
-	//}
-	//else
-	//{
-	//	ret_p = (void*)get_memLoc();
-	//	sR -= size;
-	//}
+void trace_close()
+{
+	std::lock_guard<std::mutex> lock(g_traceMutex);
+	if (!g_traceFile.is_open())
+		return;
 
-	//test for memory used up
-	SHU_ASSERT(ret_p != nullptr)
-	SHU_ASSERT((sR) >= size)
+	g_traceFile << "\n]}\n";
+	g_traceFile.close();
+}
 
-	set_spaceRemaining(sR);
+bool trace_is_open()
+{
+	return g_traceFile.is_open();
+}
 
-	//check if is in cpu space
-	SHU_ASSERT(is_within_mapped_block(get_memLoc(), get_memoryType()))
+void trace_counter(const char* track, size_t value)
+{
+	if (!trace_is_open())
+		return;
 
-	//measure alignment offset
-#if DATALOGGING_ON == 1
-	ptrdiff_t alignOffset = (uint8_t*)ret_p - get_memLoc();
-#endif
+	int64_t ts = trace_now_us();
+	std::lock_guard<std::mutex> lock(g_traceMutex);
+	trace_begin_event();
+	g_traceFile << "{\"name\":\"" << track << "\",\"ph\":\"C\",\"ts\":" << ts
+		<< ",\"pid\":1,\"tid\":0,\"args\":{\"bytes\":" << value << "}}";
+}
 
-	//inc memory address by size for next time
-	set_memLoc((uint8_t*)ret_p + size);
+void trace_instant(const char* name)
+{
+	if (!trace_is_open())
+		return;
 
-	//log stats
-#if DATALOGGING_ON == 1
-	measure_usage(alignOffset + size);
-#endif
-	return ret_p;
+	int64_t ts = trace_now_us();
+	std::lock_guard<std::mutex> lock(g_traceMutex);
+	trace_begin_event();
+	g_traceFile << "{\"name\":\"" << name << "\",\"ph\":\"i\",\"s\":\"g\",\"ts\":" << ts
+		<< ",\"pid\":1,\"tid\":" << trace_thread_id() << "}";
 }
 
-void StackAllocator::release(void* ptr) {
-	if(memblock != nullptr)
-		release_system_block(ptr);
+ScopedTraceSlice::ScopedTraceSlice(const char* sliceName) : name(sliceName), start(0)
+{
+	if (trace_is_open())
+		start = trace_now_us();
 }
 
-void StackAllocator::handle_signals(int sig) {
-	//flush scratch space...
-	switch (sig)
-	{
-	case 0:
-		reset_memory_loc();
-
-		//reset our memory usage to find size of active allocations only
-		if (get_maxSpaceUsed() > get_lastMaxSpaceUsed())
-		{
-			set_lastMaxSpaceUsed(get_maxSpaceUsed());
-		}
+ScopedTraceSlice::~ScopedTraceSlice()
+{
+	//opened mid slice - nothing to pair it with
+	if (!start || !trace_is_open())
+		return;
 
-		set_maxSpaceUsed(0);
-	}
+	int64_t end = trace_now_us();
+	std::lock_guard<std::mutex> lock(g_traceMutex);
+	trace_begin_event();
+	g_traceFile << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"ts\":" << start << ",\"dur\":" << (end - start)
+		<< ",\"pid\":1,\"tid\":" << trace_thread_id() << "}";
 }
+#pragma endregion
 
-StackAllocator::~StackAllocator() {
-	//log stats
-#if DATALOGGING_ON == 1
-	std::string name = "Stack Allocator: ";
-	switch (get_memoryType())
-	{
-	case MemoryMappingType::kCPU:
-		name += "CPU";
-		break;
-	case MemoryMappingType::kGPU:
-		name += "GPU";
-		break;
-	default:
-		name += "UNDEFINED";
-		break;
-	}
-	output_all_data(name.c_str());
+#pragma region Allocation Tags
+static thread_local AllocTag g_currentAllocTag = AllocTag::kUntagged;
 
-	std::ofstream datalog("datalog.csv", std::fstream::app);
-	datalog << "memory size:," << get_memorySize() << ",\n"
-		<< "space remaining:," << get_spaceRemaining() << ",\n\n";
-	datalog.close();
+AllocTag get_current_alloc_tag()
+{
+	return g_currentAllocTag;
+}
 
-#endif
-	//release whole chunk of memory
-	release(memblock);
+void set_current_alloc_tag(AllocTag tag)
+{
+	SHU_ASSERT(tag < AllocTag::kMaxTags);
+	g_currentAllocTag = tag;
+}
+
+const char* get_alloc_tag_name(AllocTag tag)
+{
+	static const char* kTagNames[] = {
+		"Untagged",
+		"Audio",
+		"Physics",
+		"UI",
+		"Render",
+		"Animation",
+		"AI",
+		"Gameplay",
+		"Streaming",
+	};
+	static_assert(sizeof(kTagNames) / sizeof(kTagNames[0]) == (size_t)AllocTag::kMaxTags, "tag name missing");
+
+	SHU_ASSERT(tag < AllocTag::kMaxTags);
+	return kTagNames[(size_t)tag];
 }
 #pragma endregion
 
-#pragma region Stack Allocator - With Marker Rollback
-void RollbackStackAllocator::rollback_to_marker(){
-	SHU_ASSERT(get_marker() != nullptr);
+#pragma region IMemoryAllocator Extended Base - Tags & Budgets
+void IMemoryAllocatorX::set_tag_budget(AllocTag tag, size_t softBudget, size_t hardBudget)
+{
+	set_own_tag_budget(tag, softBudget, hardBudget);
+	for_each_child([&](IMemoryAllocatorX* child) { child->set_tag_budget(tag, softBudget, hardBudget); });
+}
 
-	//find how much space we will have left when reset and set it
-	ptrdiff_t diff = get_memLoc() - get_marker();
-	set_spaceRemaining(get_spaceRemaining() + diff);
+void IMemoryAllocatorX::set_own_tag_budget(AllocTag tag, size_t softBudget, size_t hardBudget)
+{
+	tagBudget& b = tagBudgets[(size_t)tag];
+	b.soft = softBudget;
+	b.hard = hardBudget;
+}
 
-	//set active memory location to the marker we placed
-	set_memLoc(get_marker());
+void IMemoryAllocatorX::set_budget_callback(BudgetCallback cb)
+{
+	budgetCallback = cb;
+	for_each_child([&](IMemoryAllocatorX* child) { child->set_budget_callback(cb); });
 }
 
-void RollbackStackAllocator::handle_signals(int sig) {
-	switch (sig)
-	{
-	case 2:	//Begin load level
-		place_marker();
-		break;
-	case 4: //unload level
-		rollback_to_marker();
-		break;
-	}
+void IMemoryAllocatorX::get_tag_budget(AllocTag tag, size_t& softBudget, size_t& hardBudget) const
+{
+	const tagBudget& b = tagBudgets[(size_t)tag];
+	softBudget = b.soft;
+	hardBudget = b.hard;
 }
-#pragma endregion
 
-#pragma region CPU Stack Allocator - UNUSED AS BASE HAS BEEN EXTENDED
-void* CPUStackAllocator::allocate(size_t size, size_t alignment) {
+size_t IMemoryAllocatorX::get_tag_usage(AllocTag tag) const
+{
+	size_t used = tagBudgets[(size_t)tag].used;
+	for_each_child([&](IMemoryAllocatorX* child) { used += child->get_tag_usage(tag); });
+	return used;
+}
 
-	//if no memory grabbed - get it
-	if (!get_memblock())
-	{
-		//TEST MEMORY SIZE
-		int blocksize = MB * 1;	//1mb of memory	
-		set_spaceRemaining(blocksize);
-		set_memblock((uint8_t*)allocate_system_block(blocksize, MemoryMappingType::kCPU));
+//children peak at different times, so for a composite this is an upper bound
+size_t IMemoryAllocatorX::get_tag_peak(AllocTag tag) const
+{
+	size_t peak = tagBudgets[(size_t)tag].peak;
+	for_each_child([&](IMemoryAllocatorX* child) { peak += child->get_tag_peak(tag); });
+	return peak;
+}
 
-		reset_memory_loc();
-	}
+size_t IMemoryAllocatorX::get_bytes_in_use() const
+{
+	size_t used(0);
+	for (const tagBudget& t : tagBudgets)
+		used += t.used;
+	for_each_child([&](IMemoryAllocatorX* child) { used += child->get_bytes_in_use(); });
+	return used;
+}
 
-	size_t sR = get_spaceRemaining();
-	void* ret_p = nullptr;
+bool IMemoryAllocatorX::is_over_soft_budget(AllocTag tag) const
+{
+	size_t soft, hard;
+	get_tag_budget(tag, soft, hard);
+	return soft && get_tag_usage(tag) > soft;
+}
 
-	//align the first element
-	void* pCur = (void*)get_memLoc();
-	ret_p = std::align(alignment, size, pCur, sR);
+bool IMemoryAllocatorX::charge_tag(AllocTag tag, size_t size)
+{
+	tagBudget& b = tagBudgets[(size_t)tag];
+	size_t used = b.used + size;
 
-	//test for memory used up
-	SHU_ASSERT(ret_p != nullptr)
-	SHU_ASSERT((sR) >= size)
+	if (b.hard && used > b.hard)
+	{
+		if (budgetCallback)
+			budgetCallback(this, tag, used, b.hard, true);
+		return false;
+	}
 
-	set_spaceRemaining(sR);
+	//only tell anyone the first time we go over
+	if (b.soft && used > b.soft && b.used <= b.soft && budgetCallback)
+		budgetCallback(this, tag, used, b.soft, false);
 
-	//check if is in cpu space
-	SHU_ASSERT(is_within_mapped_block(get_memLoc(), MemoryMappingType::kCPU))
+	b.used = used;
+	if (used > b.peak)
+		b.peak = used;
+	return true;
+}
 
-	set_memLoc((uint8_t*)ret_p + size);	//inc memory address by size for next time
+void IMemoryAllocatorX::refund_tag(AllocTag tag, size_t size)
+{
+	tagBudget& b = tagBudgets[(size_t)tag];
+	SHU_ASSERT(b.used >= size);
+	b.used -= size;
+}
 
-	//log stats
-#if DATALOGGING_ON == 1
-	measure_usage(size);
-#endif
-	return ret_p;
+void IMemoryAllocatorX::reset_tag_usage()
+{
+	for (size_t t(0); t < (size_t)AllocTag::kMaxTags; ++t)
+		tagBudgets[t].used = 0;
 }
 
-void CPUStackAllocator::release(void* ptr) {
-	release_system_block(ptr);
+void IMemoryAllocatorX::save_tag_usage(size_t* usage) const
+{
+	for (size_t t(0); t < (size_t)AllocTag::kMaxTags; ++t)
+		usage[t] = tagBudgets[t].used;
 }
 
-CPUStackAllocator::~CPUStackAllocator(){
-	//log stats
-#if DATALOGGING_ON == 1
-	output_all_data("CPU Stack Allocator");
-#endif
+void IMemoryAllocatorX::restore_tag_usage(const size_t* usage)
+{
+	for (size_t t(0); t < (size_t)AllocTag::kMaxTags; ++t)
+		tagBudgets[t].used = usage[t];
 }
 #pragma endregion
 
-#pragma region GPU Stack Allocator - UNUSED AS BASE HAS BEEN EXTENDED
-void* GPUStackAllocator::allocate(size_t size, size_t alignment) {
+#pragma region IMemoryAllocator Extended Base - Reallocate
+void* IMemoryAllocatorX::reallocate(void* ptr, size_t oldSize, size_t newSize, size_t alignment)
+{
+	if (!ptr)
+		return allocate(newSize, alignment);
 
-	//if no memory grabbed - get it
-	if (!get_memblock())
-	{
-		//TEST MEMORY SIZE
-		int blocksize = MB * 1;	//1mb of memory	
-		set_spaceRemaining(blocksize);
-		set_memblock((uint8_t*)allocate_system_block(blocksize, MemoryMappingType::kGPU));
+	if (try_expand(ptr, newSize))
+		return ptr;
 
-		reset_memory_loc();
-	}
+	void* newPtr = allocate(newSize, alignment);
+	if (!newPtr)
+		return nullptr;
 
-	size_t sR = get_spaceRemaining();
-	void* ret_p = nullptr;
+	memcpy(newPtr, ptr, oldSize < newSize ? oldSize : newSize);
+	release_sized(ptr, oldSize, alignment);
+	return newPtr;
+}
 
-	void* pCur = (void*)get_memLoc();
-	ret_p = std::align(alignment, size, pCur, sR);
+void* IMemoryAllocatorX::allocate_zeroed(size_t size, size_t alignment)
+{
+	void* ret_p = allocate(size, alignment);
+	if (ret_p)
+		zero_allocation(ret_p, size);
+	return ret_p;
+}
 
-	//test for memory used up
-	SHU_ASSERT(ret_p != nullptr)
-		SHU_ASSERT((sR) >= size)
+void IMemoryAllocatorX::zero_allocation(void* ptr, size_t size)
+{
+	zero_memory(ptr, size);
+	zeroClearedBytes += size;
+}
+#pragma endregion
 
-		set_spaceRemaining(sR);
+#pragma region IMemoryAllocator Extended Base - Snapshot State
+//plain values in and out of a state buffer
+template <class T>
+static void put_state(std::vector<uint8_t>& state, const T& value)
+{
+	const uint8_t* p = (const uint8_t*)&value;
+	state.insert(state.end(), p, p + sizeof(T));
+}
 
-	//check if is in gpu space
-	SHU_ASSERT(is_within_mapped_block(get_memLoc(), MemoryMappingType::kGPU))
+template <class T>
+static T get_state(const uint8_t*& state)
+{
+	T value;
+	memcpy(&value, state, sizeof(T));
+	state += sizeof(T);
+	return value;
+}
 
-		set_memLoc((uint8_t*)ret_p + size);	//inc memory address by size for next time
-	return ret_p;
+bool IMemoryAllocatorX::get_snapshot_regions(std::vector<snapshotRegion>& regions) const
+{
+	//a leaf that doesnt override this is malloc backed
+	size_t childCount(0);
+	bool canSnapshot(true);
+	for_each_child([&](IMemoryAllocatorX* child) {
+		++childCount;
+		if (canSnapshot)
+			canSnapshot = child->get_snapshot_regions(regions);
+	});
+	return childCount && canSnapshot;
 }
 
-void GPUStackAllocator::release(void* ptr) {
-	release_system_block(ptr);
+void IMemoryAllocatorX::save_snapshot_state(std::vector<uint8_t>& state) const
+{
+	for (const tagBudget& t : tagBudgets)
+	{
+		put_state(state, t.used);
+		put_state(state, t.peak);
+	}
+	put_state(state, paddingBytes);
+	for_each_child([&](IMemoryAllocatorX* child) { child->save_snapshot_state(state); });
 }
 
-GPUStackAllocator::~GPUStackAllocator() {
-	//log stats
-#if DATALOGGING_ON == 1
-	output_all_data("GPU Stack Allocator");
-#endif
+bool IMemoryAllocatorX::restore_snapshot_state(const uint8_t*& state, bool checkOnly)
+{
+	for (tagBudget& t : tagBudgets)
+	{
+		size_t used = get_state<size_t>(state);
+		size_t peak = get_state<size_t>(state);
+		if (!checkOnly)
+		{
+			t.used = used;
+			t.peak = peak;
+		}
+	}
+	size_t padding = get_state<size_t>(state);
+	if (!checkOnly)
+		paddingBytes = padding;
+
+	bool matches(true);
+	for_each_child([&](IMemoryAllocatorX* child) {
+		if (matches)
+			matches = child->restore_snapshot_state(state, checkOnly);
+	});
+	return matches;
 }
 #pragma endregion
 
-#pragma region Multi / Active Frame Stack Allocator 
-void* MultiFrameAllocator::allocate(size_t size, size_t alignment) {
-
-	//if no memory grabbed - get it
-	if (!get_memblock())
+#pragma region IMemoryAllocator Extended Base - Heap Profile
+struct IMemoryAllocatorX::heapProfileData {
+	size_t sampleInterval = 0;
+	uint32_t random = 0x2545F491;
+
+	struct liveSample {
+		size_t size;
+		uint64_t stackHash;
+	};
+	std::unordered_map<const void*, liveSample> liveSamples;
+	//all time totals per distinct stack - inuse is worked out from liveSamples on gather
+	std::unordered_map<uint64_t, heapStackStats> stacks;
+
+	//exponential gap with mean sampleInterval, so samples land as a Poisson process over bytes
+	int64_t next_interval()
 	{
-		//TEST MEMORY SIZE
-		//int blocksize = KB * 159;	//minimum needed for "SingleFrameCPU: Rapid short lived allocations (no release) (With Alignment Check)"
-		int blocksize = get_memorySize();
-		set_spaceRemaining(blocksize);
-		set_memblock((uint8_t*)allocate_system_block(blocksize, get_memoryType()));
-
-		reset_memory_loc();
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		double u = (random + 1.0) / 4294967297.0;
+		return (int64_t)(-log(u) * (double)sampleInterval) + 1;
 	}
+};
 
-	size_t sR = get_spaceRemaining();
-	void* ret_p = nullptr;
+IMemoryAllocatorX::~IMemoryAllocatorX()
+{
+	delete heapProfile;
+}
 
-	//align the first element
-	void* pCur = (void*)get_memLoc();
-	ret_p = std::align(alignment, size, pCur, sR);
+void IMemoryAllocatorX::enable_heap_profile(size_t sampleInterval)
+{
+	SHU_ASSERT(sampleInterval > 0);
+	if (!heapProfile)
+		heapProfile = new heapProfileData;
 
-	//test for memory used up
-	SHU_ASSERT(ret_p != nullptr)
-	SHU_ASSERT((sR) >= size)
+	heapProfile->sampleInterval = sampleInterval;
+	profileCountdown = heapProfile->next_interval();
+	for_each_child([&](IMemoryAllocatorX* child) { child->enable_heap_profile(sampleInterval); });
+}
 
-	set_spaceRemaining(sR);
+size_t IMemoryAllocatorX::get_heap_profile_interval() const
+{
+	return heapProfile ? heapProfile->sampleInterval : 0;
+}
 
-	//check if is in cpu space
-	SHU_ASSERT(is_within_mapped_block(get_memLoc(), get_memoryType()))
+void IMemoryAllocatorX::sample_allocation(const void* ptr, size_t size)
+{
+	heapProfileData& hp = *heapProfile;
 
-	//measure alignment offset
-#if DATALOGGING_ON == 1
-	ptrdiff_t alignOffset = (uint8_t*)ret_p - get_memLoc();
-#endif
+	//a big allocation can cover several intervals - it is still one sample
+	while (profileCountdown <= 0)
+		profileCountdown += hp.next_interval();
 
-	//inc memory address by size for next time
-	set_memLoc((uint8_t*)ret_p + size);
+	void* frames[kMaxStackFrames];
+	uint32_t frameCount = capture_stack(frames, kMaxStackFrames);
 
-	//log stats
-#if DATALOGGING_ON == 1
-	measure_usage(alignOffset + size);
-#endif
-	return ret_p;
+	//FNV-1a over the return addresses
+	uint64_t hash = 14695981039346656037ull;
+	for (uint32_t i(0); i < frameCount; ++i)
+	{
+		hash ^= reinterpret_cast<uintptr_t>(frames[i]);
+		hash *= 1099511628211ull;
+	}
+
+	heapStackStats& stats = hp.stacks[hash];
+	if (stats.frameCount == 0)
+	{
+		memcpy(stats.frames, frames, frameCount * sizeof(void*));
+		stats.frameCount = frameCount;
+	}
+	++stats.allocCount;
+	stats.allocBytes += size;
+
+	hp.liveSamples[ptr] = { size, hash };
 }
 
-void MultiFrameAllocator::handle_signals(int s)
+void IMemoryAllocatorX::unsample_allocation(const void* ptr)
 {
-	switch (s)
-	{
-	case 6:
-		//how many frames do we want active data
-		//loop back to buffer start when we hit that
-		inc_frame_count();
-		if (get_frame_count() > 3)
-		{
-			reset_memory_loc();
-			reset_frame_count();
+	heapProfile->liveSamples.erase(ptr);
+}
 
-			//reset our memory usage to find size of active allocations only
-			if (get_maxSpaceUsed() > get_lastMaxSpaceUsed())
-			{
-				set_lastMaxSpaceUsed(get_maxSpaceUsed());
-			}
+void IMemoryAllocatorX::profile_release_range(const void* start, size_t size)
+{
+	if (!heapProfile)
+		return;
 
-			set_maxSpaceUsed(0);
-		}
-		break;
+	uintptr_t s = reinterpret_cast<uintptr_t>(start);
+	auto& live = heapProfile->liveSamples;
+	for (auto it = live.begin(); it != live.end();)
+	{
+		uintptr_t p = reinterpret_cast<uintptr_t>(it->first);
+		if ((s <= p) && (p < s + size))
+			it = live.erase(it);
+		else
+			++it;
 	}
 }
 
-MultiFrameAllocator::~MultiFrameAllocator() {
-	//log stats
-#if DATALOGGING_ON == 1
-	std::string name = "Ring Allocator: ";
-	switch (get_memoryType())
+void IMemoryAllocatorX::profile_release_all()
+{
+	if (heapProfile)
+		heapProfile->liveSamples.clear();
+}
+
+void IMemoryAllocatorX::gather_heap_profile(std::vector<heapStackStats>& stacks) const
+{
+	for_each_child([&](IMemoryAllocatorX* child) { child->gather_heap_profile(stacks); });
+	if (!heapProfile)
+		return;
+
+	//index our stacks in the output, then add the live samples onto them
+	std::unordered_map<uint64_t, size_t> index;
+	for (const auto& s : heapProfile->stacks)
 	{
-	case MemoryMappingType::kCPU:
-		name += "CPU";
-		break;
-	case MemoryMappingType::kGPU:
-		name += "GPU";
-		break;
-	default:
-		name += "UNDEFINED";
-		break;
+		index[s.first] = stacks.size();
+		stacks.push_back(s.second);
+		stacks.back().inuseCount = 0;
+		stacks.back().inuseBytes = 0;
+	}
+	for (const auto& l : heapProfile->liveSamples)
+	{
+		heapStackStats& stats = stacks[index[l.second.stackHash]];
+		++stats.inuseCount;
+		stats.inuseBytes += l.second.size;
 	}
-	output_all_data(name.c_str());
-#endif
 }
-#pragma endregion
 
-#pragma region CPU MF Allocator - UNUSED
-void* CPUMFAllocator::allocate(size_t size, size_t alignment) {
+bool IMemoryAllocatorX::dump_heap_profile(const char* filename) const
+{
+	size_t interval = get_heap_profile_interval();
+	if (!interval)
+		return false;
 
-	//if no memory grabbed - get it
-	if (!get_memblock())
-	{
-		//TEST MEMORY SIZE
-		int blocksize = KB * 159;	//minimum needed for "SingleFrameCPU: Rapid short lived allocations (no release) (With Alignment Check)"
-		set_spaceRemaining(blocksize);
-		set_memblock((uint8_t*)allocate_system_block(blocksize, MemoryMappingType::kCPU));
+	std::vector<heapStackStats> stacks;
+	gather_heap_profile(stacks);
 
-		reset_memory_loc();
+	heapStackStats total;
+	for (const heapStackStats& s : stacks)
+	{
+		total.inuseCount += s.inuseCount;
+		total.inuseBytes += s.inuseBytes;
+		total.allocCount += s.allocCount;
+		total.allocBytes += s.allocBytes;
 	}
 
-	size_t sR = get_spaceRemaining();
-	void* ret_p = nullptr;
+	std::ofstream profile(filename);
+	if (!profile)
+		return false;
 
-	//align the first element
-	void* pCur = (void*)get_memLoc();
-	ret_p = std::align(alignment, size, pCur, sR);
+	//header then one line per stack: "inuse objs: inuse bytes [alloc objs: alloc bytes] @ pc pc pc"
+	profile << "heap profile: " << total.inuseCount << ": " << total.inuseBytes
+		<< " [" << total.allocCount << ": " << total.allocBytes << "] @ heap_v2/" << interval << "\n";
+	for (const heapStackStats& s : stacks)
+	{
+		profile << s.inuseCount << ": " << s.inuseBytes << " [" << s.allocCount << ": " << s.allocBytes << "] @";
+		for (uint32_t i(0); i < s.frameCount; ++i)
+			profile << " 0x" << std::hex << reinterpret_cast<uintptr_t>(s.frames[i]) << std::dec;
+		profile << "\n";
+	}
 
-	//test for memory used up
-	SHU_ASSERT(ret_p != nullptr)
-	SHU_ASSERT((sR) >= size)
+#if defined(__linux__)
+	//lets pprof symbolise against the right binaries
+	std::ifstream maps("/proc/self/maps");
+	profile << "\nMAPPED_LIBRARIES:\n" << maps.rdbuf();
+#endif
+	return true;
+}
+#pragma endregion
 
-	set_spaceRemaining(sR);
+#pragma region IMemoryAllocator Extended Base - Fragmentation
+//granule for stack style heat maps - a page
+constexpr uint32_t kLayoutGranule = 4 * KB;
 
-	//check if is in cpu space
-	SHU_ASSERT(is_within_mapped_block(get_memLoc(), MemoryMappingType::kCPU))
+void IMemoryAllocatorX::fragmentationStats::add_free_extent(size_t size)
+{
+	if (!size)
+		return;
 
-	set_memLoc((uint8_t*)ret_p + size);	//inc memory address by size for next time
+	freeBytes += size;
+	++freeExtentCount;
+	if (size > largestFreeExtent)
+		largestFreeExtent = size;
 
-		//log stats
-#if DATALOGGING_ON == 1
-	measure_usage(size);
-#endif
-	return ret_p;
+	size_t bucket(0);
+	while ((size >>= 1) && bucket < kFreeExtentBuckets - 1)
+		++bucket;
+	++freeExtentHistogram[bucket];
 }
 
-void CPUMFAllocator::handle_signals(int s)
+void IMemoryAllocatorX::gather_fragmentation(fragmentationStats& stats) const
 {
-	switch (s)
-	{
-	case 6:
-		//how many frames do we want active data
-		//loop back to buffer start when we hit that
-		inc_frame_count();
-		if (get_frame_count() > 3)
-		{
-			reset_memory_loc();
-			reset_frame_count();
+	stats.paddingBytes += paddingBytes;
+	for_each_child([&](IMemoryAllocatorX* child) { child->gather_fragmentation(stats); });
+}
 
-			//reset our memory usage to find size of active allocations only
-			if (get_maxSpaceUsed() > get_lastMaxSpaceUsed())
-			{
-				set_lastMaxSpaceUsed(get_maxSpaceUsed());
-			}
+void IMemoryAllocatorX::gather_layout(std::vector<layoutRegion>& regions) const
+{
+	for_each_child([&](IMemoryAllocatorX* child) { child->gather_layout(regions); });
+}
 
-			set_maxSpaceUsed(0);
-		}
-		break;
+//a region used from its start up to used bytes - everything a stack allocator looks like
+static void add_stack_layout(std::vector<IMemoryAllocatorX::layoutRegion>& regions, const void* base, size_t size, size_t used)
+{
+	IMemoryAllocatorX::layoutRegion region;
+	region.base = base;
+	region.size = size;
+	region.granule = kLayoutGranule;
+	region.occupancy.resize((size + kLayoutGranule - 1) / kLayoutGranule);
+	for (size_t g(0); g < region.occupancy.size(); ++g)
+	{
+		size_t start = g * kLayoutGranule;
+		size_t end = start + kLayoutGranule < size ? start + kLayoutGranule : size;
+		size_t full = used < start ? 0 : (used > end ? end : used) - start;
+		region.occupancy[g] = (uint8_t)(full * 255 / (end - start));
 	}
+	regions.push_back(std::move(region));
 }
 
-CPUMFAllocator::~CPUMFAllocator() {
-	//log stats
-#if DATALOGGING_ON == 1
-	//const char* classname = __CLASS__;
-	output_all_data("CPU Ring Allocator");
-
-	std::ofstream datalog("datalog.csv", std::fstream::app);
-	datalog << "space remaining:," << get_spaceRemaining() << ",\n\n";
-	datalog.close();
-
-#endif
+bool IMemoryAllocatorX::dump_layout_snapshot(const char* filename) const
+{
+	std::vector<layoutRegion> regions;
+	gather_layout(regions);
+
+	std::ofstream snapshot(filename, std::fstream::binary | std::fstream::trunc);
+	if (!snapshot)
+		return false;
+
+	const uint32_t version = 1;
+	const uint32_t regionCount = (uint32_t)regions.size();
+	snapshot.write("MLAY", 4);
+	snapshot.write((const char*)&version, sizeof(version));
+	snapshot.write((const char*)&regionCount, sizeof(regionCount));
+	for (const layoutRegion& r : regions)
+	{
+		uint64_t base = reinterpret_cast<uintptr_t>(r.base);
+		uint64_t size = r.size;
+		uint32_t granuleCount = (uint32_t)r.occupancy.size();
+		snapshot.write((const char*)&base, sizeof(base));
+		snapshot.write((const char*)&size, sizeof(size));
+		snapshot.write((const char*)&r.granule, sizeof(r.granule));
+		snapshot.write((const char*)&granuleCount, sizeof(granuleCount));
+		snapshot.write((const char*)r.occupancy.data(), granuleCount);
+	}
+	return (bool)snapshot;
 }
 #pragma endregion
 
-#pragma region GPU MF Allocator - UNUSED
-void* GPUMFAllocator::allocate(size_t size, size_t alignment) {
+#pragma region Alligned Malloc
+void* AlignedMallocAllocator::allocate(size_t size, size_t alignment)
+{
+	AllocTag tag = get_current_alloc_tag();
+	if (!charge_tag(tag, size))
+		return nullptr;
 
-	//if no memory grabbed - get it
-	if (!get_memblock())
-	{
-		//TEST MEMORY SIZE
-		//int blocksize = KB * 159;	//minimum needed for "SingleFrameCPU: Rapid short lived allocations (no release) (With Alignment Check)"
-		int blocksize = MB * 1;		//test size
-		set_spaceRemaining(blocksize);
-		set_memblock((uint8_t*)allocate_system_block(blocksize, MemoryMappingType::kGPU));
+	//room in front for the prefix, keeping the returned pointer aligned
+	if (alignment < alignof(allocPrefix))
+		alignment = alignof(allocPrefix);
+	size_t offset = (sizeof(allocPrefix) + alignment - 1) & ~(alignment - 1);
 
-		reset_memory_loc();
+	uint8_t* base = (uint8_t*)_aligned_malloc(size + offset, alignment);
+	if (!base)
+	{
+		refund_tag(tag, size);
+		return nullptr;
 	}
 
-	size_t sR = get_spaceRemaining();
-	void* ret_p = nullptr;
-
-	//align the first element
-	void* pCur = (void*)get_memLoc();
-	ret_p = std::align(alignment, size, pCur, sR);
+	uint8_t* ret_p = base + offset;
+	allocPrefix* prefix = (allocPrefix*)ret_p - 1;
+	prefix->size = size;
+	prefix->offset = (uint32_t)offset;
+	prefix->tag = tag;
 
-	//test for memory used up
-	SHU_ASSERT(ret_p != nullptr)
-		SHU_ASSERT((sR) >= size)
+	//anything in front beyond the prefix itself is alignment padding
+	add_padding(offset - sizeof(allocPrefix));
+	profile_allocation(ret_p, size);
+	return ret_p;
+}
 
-		set_spaceRemaining(sR);
+void AlignedMallocAllocator::release(void* ptr)
+{
+	if (!ptr)
+		return;
 
-	//check if is in cpu space
-	SHU_ASSERT(is_within_mapped_block(get_memLoc(), MemoryMappingType::kGPU))
+	allocPrefix* prefix = (allocPrefix*)ptr - 1;
+	refund_tag(prefix->tag, prefix->size);
+	remove_padding(prefix->offset - sizeof(allocPrefix));
+	profile_release(ptr);
+	_aligned_free((uint8_t*)ptr - prefix->offset);
+}
 
-		set_memLoc((uint8_t*)ret_p + size);	//inc memory address by size for next time
+bool AlignedMallocAllocator::try_expand(void* ptr, size_t newSize)
+{
+	allocPrefix* prefix = (allocPrefix*)ptr - 1;
+	if (newSize <= prefix->size)
+	{
+		//the block stays as it is, but only newSize of it is charged from now on
+		refund_tag(prefix->tag, prefix->size - newSize);
+		prefix->size = newSize;
+		return true;
+	}
 
-			//log stats
-#if DATALOGGING_ON == 1
-	measure_usage(size);
+#if defined(__linux__)
+	//glibc often rounds blocks up - we can use that, but cant reach a neighbour without risking a move
+	size_t usable = malloc_usable_size((uint8_t*)ptr - prefix->offset) - prefix->offset;
+	if (newSize > usable)
+		return false;
+	if (!charge_tag(prefix->tag, newSize - prefix->size))
+		return false;
+
+	prefix->size = newSize;
+	return true;
+#else
+	//_aligned_msize only gives back the size that was asked for, so there is never room to grow into
+	return false;
 #endif
-	return ret_p;
 }
+#pragma endregion
 
-GPUMFAllocator::~GPUMFAllocator() {
-	//log stats
-#if DATALOGGING_ON == 1
-	output_all_data("GPU Ring Allocator");
+#pragma region IMemoryAllocator Extended Base - Measurement Helpers
+void IMemoryAllocatorX::measure_usage(size_t size)
+{
+	maxSpaceUsed += size;
+	++maxNumActiveAllocations;
+
+	if (size > largestAllocation)
+		largestAllocation = size;
+}
+
+void IMemoryAllocatorX::output_all_data(const char* cn)
+{
+	//early out if we already have data
+	if (get_isDataOutputted())
+		return;
 
 	std::ofstream datalog("datalog.csv", std::fstream::app);
-	datalog << "space remaining:," << get_spaceRemaining() << ",\n\n";
+	datalog << cn << ",\n"
+		<< "largest allocation:," << largestAllocation << " B,\n"
+		<< "max space used (active allocations):," << lastMaxSpaceUsed << " B," << (float)(lastMaxSpaceUsed / KB) << " KB," << (float)(lastMaxSpaceUsed / MB) << " MB,\n"
+		<< "max space used (all):," << maxSpaceUsed << " B," << (float)(maxSpaceUsed / KB) << " KB," << (float)(maxSpaceUsed / MB) << " MB,\n"
+		<< "max active allocations (active allocations):," << lastMaxNumActiveAllocations << ",\n"
+		<< "max active allocations (all):," << maxNumActiveAllocations << ",\n";
+
+	//peak usage of any tag that allocated from us
+	for (size_t t(0); t < (size_t)AllocTag::kMaxTags; ++t)
+	{
+		if (tagBudgets[t].peak)
+			datalog << "tag peak:," << get_alloc_tag_name((AllocTag)t) << "," << tagBudgets[t].peak << " B,\n";
+	}
+
+	fragmentationStats frag;
+	gather_fragmentation(frag);
+	datalog << "free bytes:," << frag.freeBytes << " B,\n"
+		<< "largest free extent:," << frag.largestFreeExtent << " B,\n"
+		<< "free extents:," << frag.freeExtentCount << ",\n"
+		<< "padding bytes:," << frag.paddingBytes << " B,\n";
+	if (zeroClearedBytes)
+		datalog << "zeroed bytes cleared:," << zeroClearedBytes << " B,\n";
+	datalog << "\n";
 	datalog.close();
 
-#endif
+	//set flag if this is the first data to be outputted
+	set_isDataOutputted();
 }
-#pragma endregion
 
-#pragma region Free List Allocator - DRAFT IDEA SMALL OBJECT TEST
-//void * ObjectPoolManager::allocate(size_t size, size_t alignment)
+void IMemoryAllocatorX::set_maxSpaceUsed(size_t s)
+{
+	maxSpaceUsed = s;
+}
+
+void IMemoryAllocatorX::set_lastMaxSpaceUsed(size_t s)
+{
+	lastMaxSpaceUsed = s;
+}
+#pragma endregion
+
+#pragma region NUMA Helpers
+//mbind policy values from numaif.h - saves depending on libnuma headers
+constexpr int kMpolPreferred = 1;
+constexpr unsigned kMpolMfMove = 1 << 1;
+
+int get_numa_node_count()
+{
+	static int nodeCount = 0;
+	if (nodeCount)
+		return nodeCount;
+
+	nodeCount = 1;
+#if defined(_WIN32)
+	ULONG highestNode = 0;
+	if (GetNumaHighestNodeNumber(&highestNode))
+		nodeCount = (int)highestNode + 1;
+#elif defined(__linux__)
+	//list of online nodes looks like "0" or "0-1" or "0,2-3" - the last number is the highest node
+	std::ifstream online("/sys/devices/system/node/online");
+	std::string nodes;
+	if (online >> nodes)
+	{
+		size_t lastSep = nodes.find_last_of(",-");
+		nodeCount = atoi(nodes.c_str() + (lastSep == std::string::npos ? 0 : lastSep + 1)) + 1;
+	}
+#endif
+	if (nodeCount > kMaxNumaNodes)
+		nodeCount = kMaxNumaNodes;
+	return nodeCount;
+}
+
+int get_current_numa_node()
+{
+	//threads rarely hop between sockets - only re-query every so often
+	constexpr uint32_t kNodeRefreshInterval = 256;
+	static thread_local int cachedNode = 0;
+	static thread_local uint32_t callsUntilRefresh = 0;
+
+	if (callsUntilRefresh-- != 0)
+		return cachedNode;
+	callsUntilRefresh = kNodeRefreshInterval - 1;
+
+	int node = 0;
+#if defined(_WIN32)
+	PROCESSOR_NUMBER procNumber;
+	USHORT winNode = 0;
+	GetCurrentProcessorNumberEx(&procNumber);
+	if (GetNumaProcessorNodeEx(&procNumber, &winNode))
+		node = winNode;
+#elif defined(__linux__)
+	unsigned cpu = 0, linuxNode = 0;
+	if (syscall(SYS_getcpu, &cpu, &linuxNode, nullptr) == 0)
+		node = (int)linuxNode;
+#endif
+	if (node >= get_numa_node_count())
+		node = 0;
+
+	cachedNode = node;
+	return cachedNode;
+}
+
+#pragma endregion
+
+#pragma region System Block Broker
+struct brokerSuperBlock {
+	struct extent {
+		uint8_t* start;
+		size_t size;
+	};
+
+	uint8_t* block;
+	size_t size;
+	MemoryMappingType type;
+	//free space, by address and never touching
+	std::vector<extent> freeExtents;
+};
+
+struct brokerState {
+	std::vector<brokerSuperBlock> superBlocks;
+	struct region {
+		size_t superIndex;
+		size_t size;
+	};
+	std::unordered_map<uint8_t*, region> regions;
+	size_t reservedBytes = 0;
+	size_t regionBytes = 0;
+	size_t peakRegionBytes = 0;
+};
+
+//made on first use - allocators can be made before main - and deleted once every super block has gone back
+static brokerState* g_broker = nullptr;
+
+//the lock outlives the state it guards
+static std::mutex& get_broker_lock()
+{
+	static std::mutex lock;
+	return lock;
+}
+
+//caller holds the broker lock
+static brokerState& get_broker()
+{
+	if (!g_broker)
+		g_broker = new brokerState;
+	return *g_broker;
+}
+
+//regions are cut on page boundaries, whatever the block's own alignment
+static void get_super_block_pages(const brokerSuperBlock& super, uint8_t*& start, uint8_t*& end)
+{
+	start = (uint8_t*)(((uintptr_t)super.block + kSystemRegionAlignment - 1) & ~(uintptr_t)(kSystemRegionAlignment - 1));
+	end = (uint8_t*)(((uintptr_t)super.block + super.size) & ~(uintptr_t)(kSystemRegionAlignment - 1));
+}
+
+//first fit - lowest address, so long lived regions pack at the bottom
+static uint8_t* take_region(brokerSuperBlock& super, size_t size)
+{
+	for (size_t i(0); i < super.freeExtents.size(); ++i)
+	{
+		brokerSuperBlock::extent& e = super.freeExtents[i];
+		if (e.size < size)
+			continue;
+
+		uint8_t* region = e.start;
+		e.start += size;
+		e.size -= size;
+		if (!e.size)
+			super.freeExtents.erase(super.freeExtents.begin() + i);
+		return region;
+	}
+	return nullptr;
+}
+
+//prefer the node for every page of the region, moving any already touched
+//this is only a hint - if it fails the region is still perfectly usable
+static void bind_region_to_node(void* region, size_t size, int node)
+{
+	if (node == kAnyNumaNode || get_numa_node_count() < 2)
+		return;
+
+#if defined(__linux__)
+	unsigned long nodeMask = 1ul << node;
+	syscall(SYS_mbind, region, size, kMpolPreferred, &nodeMask, sizeof(nodeMask) * 8, kMpolMfMove);
+#else
+	//other platforms: the system block comes from the generic allocator, no binding
+	(void)region;
+	(void)size;
+#endif
+}
+
+void* acquire_system_region(size_t size, MemoryMappingType mappingType, int node)
+{
+	ScopedTraceSlice slice("acquire_system_region");
+	size = (size + kSystemRegionAlignment - 1) & ~(kSystemRegionAlignment - 1);
+	if (!size)
+		size = kSystemRegionAlignment;
+
+	uint8_t* region = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(get_broker_lock());
+		brokerState& broker = get_broker();
+
+		size_t superIndex = 0;
+		size_t lastSuperSize = 0;
+		for (; superIndex < broker.superBlocks.size() && !region; ++superIndex)
+		{
+			if (!broker.superBlocks[superIndex].block || broker.superBlocks[superIndex].type != mappingType)
+				continue;
+			region = take_region(broker.superBlocks[superIndex], size);
+			lastSuperSize = broker.superBlocks[superIndex].size - kSystemRegionAlignment;
+		}
+
+		//nothing free is big enough - another super block, at least big enough for this on its own
+		if (!region)
+		{
+			size_t superSize = lastSuperSize ? 2 * lastSuperSize : kMinSuperBlockSize;
+			if (superSize < size)
+				superSize = (size + kMinSuperBlockSize - 1) & ~(kMinSuperBlockSize - 1);
+			//room to line the regions up on a page, whatever the block's own alignment
+			superSize += kSystemRegionAlignment;
+			uint8_t* block = (uint8_t*)allocate_system_block(superSize, mappingType);
+			if (!block)
+				return nullptr;
+
+			brokerSuperBlock super;
+			super.block = block;
+			super.size = superSize;
+			super.type = mappingType;
+			uint8_t* start;
+			uint8_t* end;
+			get_super_block_pages(super, start, end);
+			super.freeExtents.push_back({ start, (size_t)(end - start) });
+
+			broker.superBlocks.push_back(super);
+			broker.reservedBytes += superSize;
+			superIndex = broker.superBlocks.size();
+			region = take_region(broker.superBlocks.back(), size);
+			SHU_ASSERT(region != nullptr);
+		}
+
+		broker.regions[region] = { superIndex - 1, size };
+		broker.regionBytes += size;
+		if (broker.regionBytes > broker.peakRegionBytes)
+			broker.peakRegionBytes = broker.regionBytes;
+	}
+
+	bind_region_to_node(region, size, node);
+	return region;
+}
+
+void release_system_region(void* ptr)
+{
+	SHU_ASSERT(ptr);
+	std::lock_guard<std::mutex> lock(get_broker_lock());
+	SHU_ASSERT(g_broker != nullptr);
+	if (!g_broker)
+		return;
+	brokerState& broker = *g_broker;
+
+	std::unordered_map<uint8_t*, brokerState::region>::iterator it = broker.regions.find((uint8_t*)ptr);
+	SHU_ASSERT(it != broker.regions.end());
+	if (it == broker.regions.end())
+		return;
+
+	brokerSuperBlock& super = broker.superBlocks[it->second.superIndex];
+	uint8_t* start = it->first;
+	size_t size = it->second.size;
+	broker.regionBytes -= size;
+	broker.regions.erase(it);
+
+	//back in address order, merged into whichever neighbours it touches
+	std::vector<brokerSuperBlock::extent>& extents = super.freeExtents;
+	size_t i = 0;
+	while (i < extents.size() && extents[i].start < start)
+		++i;
+	bool joinsPrev = i > 0 && extents[i - 1].start + extents[i - 1].size == start;
+	bool joinsNext = i < extents.size() && start + size == extents[i].start;
+	if (joinsPrev && joinsNext)
+	{
+		extents[i - 1].size += size + extents[i].size;
+		extents.erase(extents.begin() + i);
+	}
+	else if (joinsPrev)
+	{
+		extents[i - 1].size += size;
+	}
+	else if (joinsNext)
+	{
+		extents[i].start = start;
+		extents[i].size += size;
+	}
+	else
+	{
+		extents.insert(extents.begin() + i, { start, size });
+	}
+}
+
+size_t release_empty_super_blocks()
+{
+	std::lock_guard<std::mutex> lock(get_broker_lock());
+	if (!g_broker)
+		return 0;
+
+	//empty once its one free extent runs from its first page to its last
+	size_t kept = 0;
+	for (brokerSuperBlock& super : g_broker->superBlocks)
+	{
+		if (!super.block)
+			continue;
+
+		uint8_t* start;
+		uint8_t* end;
+		get_super_block_pages(super, start, end);
+		if (super.freeExtents.size() != 1 || super.freeExtents[0].start != start || super.freeExtents[0].size != (size_t)(end - start))
+		{
+			++kept;
+			continue;
+		}
+
+		release_system_block(super.block);
+		g_broker->reservedBytes -= super.size;
+		super.block = nullptr;
+		std::vector<brokerSuperBlock::extent>().swap(super.freeExtents);
+	}
+
+	if (!kept)
+	{
+		delete g_broker;
+		g_broker = nullptr;
+	}
+	return kept;
+}
+
+systemBrokerStats get_system_broker_stats()
+{
+	std::lock_guard<std::mutex> lock(get_broker_lock());
+	systemBrokerStats stats = {};
+	if (!g_broker)
+		return stats;
+
+	brokerState& broker = *g_broker;
+	for (const brokerSuperBlock& super : broker.superBlocks)
+	{
+		if (super.block)
+			++stats.superBlockCount;
+	}
+	stats.reservedBytes = broker.reservedBytes;
+	stats.regionCount = broker.regions.size();
+	stats.regionBytes = broker.regionBytes;
+	stats.peakRegionBytes = broker.peakRegionBytes;
+	return stats;
+}
+#pragma endregion
+
+#pragma region Stack Allocator - ALL PURPOSE
+void* StackAllocator::allocate(size_t size, size_t alignment) {
+
+	//if no memory grabbed - get it, the system may have none left for a main block but can still chain overflow
+	if (!ensure_main_block())
+		return allocate_overflow(size, alignment);
+
+	size_t sR = get_spaceRemaining();
+	void* ret_p = nullptr;
+
+	//override the alignment?
+	//if (get_alignment_override() == false)
+	//{
+		//align the first element
+		void* pCur = (void*)get_memLoc();
+		ret_p = std::align(alignment, size, pCur, sR);
+	//}
+	//else
+	//{
+	//	ret_p = (void*)get_memLoc();
+	//	sR -= size;
+	//}
+
+	//main block is used up - chain on to overflow rather than fall over
+	if (ret_p == nullptr)
+		return allocate_overflow(size, alignment);
+	SHU_ASSERT((sR) >= size)
+
+	//over a hard budget for this tag - refuse without touching the stack
+	AllocTag tag = get_current_alloc_tag();
+	if (!charge_tag(tag, size))
+		return nullptr;
+
+	//std::align only takes off the padding, take the allocation off too
+	set_spaceRemaining(sR - size);
+
+	//check if is in cpu space
+	SHU_ASSERT(is_within_mapped_block(get_memLoc(), get_memoryType()))
+
+	//measure alignment offset
+	ptrdiff_t alignOffset = (uint8_t*)ret_p - get_memLoc();
+	add_padding(alignOffset);
+
+	//inc memory address by size for next time
+	push_top_allocation(ret_p, size, alignOffset, tag);
+
+	//log stats
+#if DATALOGGING_ON == 1
+	measure_usage(alignOffset + size);
+#endif
+	profile_allocation(ret_p, size);
+	return ret_p;
+}
+
+bool StackAllocator::ensure_main_block() {
+	if (!get_memblock())
+	{
+		acquire_main_block(get_memorySize());
+		//nothing to reset onto - tried again next time
+		if (!get_memblock())
+			return false;
+
+		reset_memory_loc();
+	}
+	return true;
+}
+
+void StackAllocator::acquire_main_block(size_t size) {
+	set_memblock((uint8_t*)acquire_system_region(size, memoryType, numaNode));
+}
+
+void StackAllocator::release(void* /*ptr*/) {
+	//individual allocations come back in bulk on flush / wrap / rollback
+	//(handing ptr to release_system_block gave the whole block away when ptr was the first allocation)
+}
+
+void StackAllocator::release_sized(void* ptr, size_t size, size_t /*alignment*/) {
+	//top of the main block - step back so the space is reused straight away
+	uint8_t* oldLoc = memLoc;
+	if (pop_top_allocation(ptr, size))
+	{
+		spaceRemaining += oldLoc - memLoc;
+		return;
+	}
+	release(ptr);
+}
+
+void StackAllocator::push_top_allocation(void* ptr, size_t size, size_t padding, AllocTag tag) {
+	memLoc = (uint8_t*)ptr + size;
+	update_high_water();
+
+	topRecords[topNext % kTopRecords] = { (uint8_t*)ptr, (uint32_t)padding, tag };
+	++topNext;
+	if (topCount < kTopRecords)
+		++topCount;
+}
+
+bool StackAllocator::pop_top_allocation(void* ptr, size_t size) {
+	const topRecord* top = get_top_record();
+	if (!top || top->ptr != ptr || (uint8_t*)ptr + size != memLoc)
+		return false;
+
+	//back to where memLoc was before it was handed out, charge and padding with it
+	refund_tag(top->tag, size);
+	remove_padding(top->padding);
+	memLoc = top->ptr - top->padding;
+	--topNext;
+	--topCount;
+	profile_release(ptr);
+	return true;
+}
+
+bool StackAllocator::owns(const void* ptr) {
+	uintptr_t s = reinterpret_cast<uintptr_t>(memblock);
+	uintptr_t p = reinterpret_cast<uintptr_t>(ptr);
+	if (memblock && (s <= p) && (p < s + memorySize))
+		return true;
+
+	//might be in the overflow
+	for (const std::vector<overflowEntry>* entries : { &overflowEntries, &retiredOverflowEntries, &spareOverflowEntries })
+	{
+		for (const overflowEntry& e : *entries)
+		{
+			uintptr_t es = reinterpret_cast<uintptr_t>(e.mem);
+			if ((es <= p) && (p < es + e.size))
+				return true;
+		}
+	}
+	return false;
+}
+
+//smallest block we bother chaining on
+constexpr size_t kMinOverflowBlockSize = 64 * KB;
+
+void* StackAllocator::allocate_overflow(size_t size, size_t alignment) {
+	if (!charge_tag(get_current_alloc_tag(), size))
+		return nullptr;
+
+	void* ret_p = nullptr;
+
+	//try the newest overflow block first
+	if (overflowLoc)
+	{
+		void* pCur = overflowLoc;
+		size_t sR = overflowRemaining;
+		ret_p = std::align(alignment, size, pCur, sR);
+		if (ret_p)
+		{
+			add_padding(overflowRemaining - sR);
+			overflowRemaining = sR - size;
+			overflowLoc = (uint8_t*)ret_p + size;
+		}
+	}
+
+	//chain another block - big enough for what overflowed last cycle so one block covers a repeat
+	if (!ret_p)
+	{
+		size_t blocksize = size + alignment;
+		if (blocksize < overflowBytesLastCycle)
+			blocksize = overflowBytesLastCycle;
+		if (blocksize < kMinOverflowBlockSize)
+			blocksize = kMinOverflowBlockSize;
+
+		//reuse a spare block if one is big enough for this allocation
+		uint8_t* block = nullptr;
+		for (size_t i(0); i < spareOverflowEntries.size(); ++i)
+		{
+			if (spareOverflowEntries[i].size >= size + alignment)
+			{
+				block = spareOverflowEntries[i].mem;
+				blocksize = spareOverflowEntries[i].size;
+				spareOverflowEntries.erase(spareOverflowEntries.begin() + i);
+				break;
+			}
+		}
+
+		if (!block)
+			block = (uint8_t*)acquire_system_region(blocksize, get_memoryType(), get_numaNode());
+
+		if (block)
+		{
+			overflowEntries.push_back({ block, blocksize, false });
+
+			void* pCur = block;
+			size_t sR = blocksize;
+			ret_p = std::align(alignment, size, pCur, sR);
+			SHU_ASSERT(ret_p != nullptr);
+			add_padding(blocksize - sR);
+			overflowRemaining = sR - size;
+			overflowLoc = (uint8_t*)ret_p + size;
+		}
+	}
+
+	//out of system blocks - last resort is the backup allocator, as long as it keeps the mapping
+	if (!ret_p && overflowAllocator)
+	{
+		ret_p = overflowAllocator->allocate(size, alignment);
+		if (ret_p && get_memoryType() != MemoryMappingType::kUndefined && !is_within_mapped_block(ret_p, get_memoryType()))
+		{
+			overflowAllocator->release(ret_p);
+			ret_p = nullptr;
+		}
+		if (ret_p)
+			overflowEntries.push_back({ (uint8_t*)ret_p, size, true });
+	}
+
+	if (!ret_p)
+	{
+		refund_tag(get_current_alloc_tag(), size);
+		return nullptr;
+	}
+
+	//record the overflow event
+	++overflowCount;
+	overflowBytesCycle += size;
+	if (overflowBytesCycle > overflowBytesPeak)
+		overflowBytesPeak = overflowBytesCycle;
+
+#if DATALOGGING_ON == 1
+	measure_usage(size);
+#endif
+	profile_allocation(ret_p, size);
+	return ret_p;
+}
+
+StackAllocator::overflowMark StackAllocator::mark_overflow() const {
+	overflowMark mark;
+	mark.entryCount = overflowEntries.size();
+	mark.loc = overflowLoc;
+	mark.remaining = overflowRemaining;
+	return mark;
+}
+
+void StackAllocator::rollback_overflow(const overflowMark& mark) {
+	//give back anything chained on after the mark
+	while (overflowEntries.size() > mark.entryCount)
+	{
+		recycle_overflow(overflowEntries.back());
+		overflowEntries.pop_back();
+	}
+
+	overflowLoc = mark.loc;
+	overflowRemaining = mark.remaining;
+}
+
+void StackAllocator::retire_overflow() {
+	//anything retired last time has now definitely gone out of use
+	for (overflowEntry& e : retiredOverflowEntries)
+		recycle_overflow(e);
+	retiredOverflowEntries.clear();
+	retiredOverflowEntries.swap(overflowEntries);
+
+	overflowLoc = nullptr;
+	overflowRemaining = 0;
+
+	//size next cycle's first overflow block off this one
+	overflowBytesLastCycle = overflowBytesCycle;
+	overflowBytesCycle = 0;
+}
+
+void StackAllocator::release_overflow() {
+	retire_overflow();
+	retire_overflow();
+}
+
+void StackAllocator::release_spare_overflow() {
+	for (overflowEntry& e : spareOverflowEntries)
+		release_system_region(e.mem);
+	spareOverflowEntries.clear();
+}
+
+void StackAllocator::recycle_overflow(overflowEntry& e) {
+	profile_release_range(e.mem, e.size);
+	if (e.fromBackup)
+		overflowAllocator->release(e.mem);
+	else
+		spareOverflowEntries.push_back(e);
+}
+
+void StackAllocator::seal_overflow() {
+	overflowLoc = nullptr;
+	overflowRemaining = 0;
+
+	overflowBytesLastCycle = overflowBytesCycle;
+	overflowBytesCycle = 0;
+}
+
+void StackAllocator::recycle_oldest_overflow(size_t count) {
+	SHU_ASSERT(count <= overflowEntries.size());
+	for (size_t i(0); i < count; ++i)
+		recycle_overflow(overflowEntries[i]);
+	overflowEntries.erase(overflowEntries.begin(), overflowEntries.begin() + count);
+}
+
+bool StackAllocator::try_expand(void* ptr, size_t newSize) {
+	const topRecord* top = get_top_record();
+	if (!top || ptr != top->ptr)
+		return false;
+
+	//already big enough
+	size_t oldSize = memLoc - top->ptr;
+	if (newSize <= oldSize)
+		return true;
+
+	size_t extra = newSize - oldSize;
+	if (extra > spaceRemaining)
+		return false;
+	//same tag as the rest of it, so a pop refunds the lot from one place
+	if (!charge_tag(top->tag, extra))
+		return false;
+
+	memLoc += extra;
+	spaceRemaining -= extra;
+	update_high_water();
+	return true;
+}
+
+size_t StackAllocator::get_sizing_high_water() const {
+	//overflow only happens once the main block is full
+	return overflowBytesPeak ? memorySize + overflowBytesPeak : mainHighWater;
+}
+
+void StackAllocator::gather_fragmentation(fragmentationStats& stats) const {
+	IMemoryAllocatorX::gather_fragmentation(stats);
+
+	//only the top of a stack is free - anything skipped for overflow stays stranded until reset
+	if (memblock)
+		stats.add_free_extent(spaceRemaining);
+	if (overflowLoc)
+		stats.add_free_extent(overflowRemaining);
+	for (const overflowEntry& e : spareOverflowEntries)
+		stats.add_free_extent(e.size);
+}
+
+void StackAllocator::gather_layout(std::vector<layoutRegion>& regions) const {
+	if (memblock)
+		add_stack_layout(regions, memblock, memorySize, memorySize - spaceRemaining);
+
+	for (size_t i(0); i < overflowEntries.size(); ++i)
+	{
+		const overflowEntry& e = overflowEntries[i];
+		//only the newest block is still being filled
+		bool isCurrent = overflowLoc && !e.fromBackup && (i + 1 == overflowEntries.size());
+		add_stack_layout(regions, e.mem, e.size, isCurrent ? e.size - overflowRemaining : e.size);
+	}
+	for (const overflowEntry& e : retiredOverflowEntries)
+		add_stack_layout(regions, e.mem, e.size, e.size);
+	for (const overflowEntry& e : spareOverflowEntries)
+		add_stack_layout(regions, e.mem, e.size, 0);
+}
+
+bool StackAllocator::get_snapshot_regions(std::vector<snapshotRegion>& regions) const {
+	//always there even when empty, so the region list only changes shape with the overflow chain
+	if (memblock)
+		regions.push_back({ memblock, (size_t)(memLoc - memblock) });
+	for (const std::vector<overflowEntry>* entries : { &overflowEntries, &retiredOverflowEntries })
+	{
+		for (const overflowEntry& e : *entries)
+			regions.push_back({ e.mem, e.size });
+	}
+	return true;
+}
+
+void StackAllocator::save_snapshot_state(std::vector<uint8_t>& state) const {
+	IMemoryAllocatorX::save_snapshot_state(state);
+	put_state(state, memblock);
+	put_state(state, memLoc);
+	put_state(state, spaceRemaining);
+	put_state(state, topRecords);
+	put_state(state, topNext);
+	put_state(state, topCount);
+	put_state(state, overflowLoc);
+	put_state(state, overflowRemaining);
+	put_state(state, overflowBytesCycle);
+	put_state(state, relocations.size());
+	for (const std::vector<overflowEntry>* entries : { &overflowEntries, &retiredOverflowEntries })
+	{
+		put_state(state, entries->size());
+		for (const overflowEntry& e : *entries)
+			put_state(state, e.mem);
+	}
+}
+
+bool StackAllocator::restore_snapshot_state(const uint8_t*& state, bool checkOnly) {
+	if (!IMemoryAllocatorX::restore_snapshot_state(state, checkOnly))
+		return false;
+
+	uint8_t* savedBlock = get_state<uint8_t*>(state);
+	uint8_t* savedLoc = get_state<uint8_t*>(state);
+	size_t savedRemaining = get_state<size_t>(state);
+	const uint8_t* savedTops = state;
+	state += sizeof(topRecords);
+	size_t savedTopNext = get_state<size_t>(state);
+	size_t savedTopCount = get_state<size_t>(state);
+	uint8_t* savedOverflowLoc = get_state<uint8_t*>(state);
+	size_t savedOverflowRemaining = get_state<size_t>(state);
+	size_t savedOverflowBytes = get_state<size_t>(state);
+	size_t savedRelocations = get_state<size_t>(state);
+
+	//the overflow chain has to be exactly as it was - its blocks are what got copied
+	bool matches = (savedBlock == memblock);
+	for (const std::vector<overflowEntry>* entries : { &overflowEntries, &retiredOverflowEntries })
+	{
+		size_t count = get_state<size_t>(state);
+		matches = matches && (count == entries->size());
+		for (size_t i(0); i < count; ++i)
+		{
+			uint8_t* mem = get_state<uint8_t*>(state);
+			matches = matches && (i < entries->size()) && ((*entries)[i].mem == mem);
+		}
+	}
+	if (!matches || checkOnly)
+		return matches;
+
+	memLoc = savedLoc;
+	spaceRemaining = savedRemaining;
+	memcpy(topRecords, savedTops, sizeof(topRecords));
+	topNext = savedTopNext;
+	topCount = savedTopCount;
+	overflowLoc = savedOverflowLoc;
+	overflowRemaining = savedOverflowRemaining;
+	overflowBytesCycle = savedOverflowBytes;
+	//slots added since are gone, ones dropped since cant come back
+	if (relocations.size() > savedRelocations)
+		relocations.resize(savedRelocations);
+	return true;
+}
+
+//image file layout: header, relocation offsets, then the region data on a page boundary so it can be mapped
+struct arenaImageHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t base;	//where the region was when saved
+	uint64_t size;
+	uint64_t relocationCount;
+	uint64_t dataOffset;
+};
+constexpr uint32_t kArenaImageVersion = 1;
+//not worth a mapping below this - just read it
+constexpr size_t kMinMappedImageSize = 64 * KB;
+
+void StackAllocator::add_relocation(void** slot) {
+	SHU_ASSERT(memblock && (uint8_t*)slot >= memblock && (uint8_t*)slot < memLoc);
+	relocations.push_back((uint8_t*)slot - memblock);
+}
+
+void StackAllocator::drop_relocations(const uint8_t* from) {
+	size_t fromOffset = from - memblock;
+	size_t kept(0);
+	for (size_t r : relocations)
+	{
+		if (r < fromOffset)
+			relocations[kept++] = r;
+	}
+	relocations.resize(kept);
+}
+
+bool StackAllocator::save_image(const char* filename, const void* regionStart) const {
+	//overflow blocks arent contiguous with the region
+	if (!memblock || !overflowEntries.empty())
+		return false;
+
+	const uint8_t* start = regionStart ? (const uint8_t*)regionStart : memblock;
+	SHU_ASSERT(start >= memblock && start <= memLoc);
+	size_t size = memLoc - start;
+
+	//only slots still inside the region - anything rolled back or flushed since is stale
+	std::vector<uint64_t> offsets;
+	for (size_t r : relocations)
+	{
+		const uint8_t* slot = memblock + r;
+		if (slot >= start && slot + sizeof(void*) <= memLoc)
+			offsets.push_back(slot - start);
+	}
+
+	size_t pageSize = get_page_size();
+	arenaImageHeader header = { { 'A', 'I', 'M', 'G' }, kArenaImageVersion, reinterpret_cast<uintptr_t>(start), size, offsets.size(), 0 };
+	header.dataOffset = (sizeof(header) + offsets.size() * sizeof(uint64_t) + pageSize - 1) & ~(uint64_t)(pageSize - 1);
+
+	std::ofstream image(filename, std::fstream::binary | std::fstream::trunc);
+	if (!image)
+		return false;
+
+	image.write((const char*)&header, sizeof(header));
+	image.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+	std::vector<char> pad((size_t)header.dataOffset - sizeof(header) - offsets.size() * sizeof(uint64_t), 0);
+	image.write(pad.data(), pad.size());
+	image.write((const char*)start, size);
+	return (bool)image;
+}
+
+void* StackAllocator::load_image(const char* filename) {
+	std::ifstream image(filename, std::fstream::binary);
+	if (!image)
+		return nullptr;
+
+	arenaImageHeader header;
+	if (!image.read((char*)&header, sizeof(header)) || memcmp(header.magic, "AIMG", 4) != 0 || header.version != kArenaImageVersion)
+		return nullptr;
+
+	//nothing in the header is trusted until it is checked against the file - a truncated or
+	//corrupt image is refused before anything is allocated, mapped or written
+	image.seekg(0, std::ios::end);
+	uint64_t fileSize = (uint64_t)image.tellg();
+	image.seekg(sizeof(header));
+	if (header.dataOffset < sizeof(header) || header.dataOffset > fileSize || header.size > fileSize - header.dataOffset)
+		return nullptr;
+	//the offsets sit between the header and the data
+	if (header.relocationCount > (header.dataOffset - sizeof(header)) / sizeof(uint64_t))
+		return nullptr;
+
+	std::vector<uint64_t> offsets((size_t)header.relocationCount);
+	if (!image.read((char*)offsets.data(), offsets.size() * sizeof(uint64_t)))
+		return nullptr;
+	//every slot has to lie wholly inside the region
+	for (uint64_t off : offsets)
+	{
+		if (off > header.size || header.size - off < sizeof(uintptr_t))
+			return nullptr;
+	}
+
+	if (!ensure_main_block())
+		return nullptr;
+
+	ScopedTraceSlice slice("load_arena_image");
+	size_t size = (size_t)header.size;
+	size_t pageSize = get_page_size();
+	uint8_t* blockEnd = memblock + memorySize;
+
+	//page aligned lets big images be mapped in rather than copied
+	uint8_t* dest = (uint8_t*)(((uintptr_t)memLoc + pageSize - 1) & ~(uintptr_t)(pageSize - 1));
+	if (dest + size > blockEnd)
+		dest = (uint8_t*)(((uintptr_t)memLoc + 15) & ~(uintptr_t)15);
+	if (dest + size > blockEnd)
+		return nullptr;
+	if (!charge_tag(get_current_alloc_tag(), size))
+		return nullptr;
+
+	bool loaded = false;
+#if defined(__linux__)
+	//private mapping over our own pages - clean pages read straight from the file cache
+	//the file must not change while the level is loaded
+	size_t mapSize = (size + pageSize - 1) & ~(pageSize - 1);
+	if (size >= kMinMappedImageSize && ((uintptr_t)dest & (pageSize - 1)) == 0 && dest + mapSize <= blockEnd)
+	{
+		int fd = open(filename, O_RDONLY);
+		if (fd >= 0)
+		{
+			loaded = mmap(dest, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)header.dataOffset) != MAP_FAILED;
+			close(fd);
+			if (loaded && dest + mapSize > imageMapEnd)
+				imageMapEnd = dest + mapSize;
+		}
+	}
+#endif
+	if (!loaded)
+	{
+		image.seekg((std::streamoff)header.dataOffset);
+		loaded = (bool)image.read((char*)dest, size);
+	}
+	if (!loaded)
+	{
+		refund_tag(get_current_alloc_tag(), size);
+		return nullptr;
+	}
+
+	//pointers into the region move with it - anything pointing elsewhere is left alone
+	uintptr_t oldBase = (uintptr_t)header.base;
+	uintptr_t delta = (uintptr_t)dest - oldBase;
+	for (uint64_t off : offsets)
+	{
+		uintptr_t* slot = (uintptr_t*)(dest + off);
+		if (delta && *slot >= oldBase && *slot < oldBase + size)
+			*slot += delta;
+		relocations.push_back(dest + off - memblock);
+	}
+
+	add_padding(dest - memLoc);
+	spaceRemaining -= (dest + size) - memLoc;
+	set_memLoc(dest + size);
+	return dest;
+}
+
+void StackAllocator::handle_signals(GameEventType sig) {
+	//flush scratch space...
+	switch (sig)
+	{
+	case GameEventType::kEventFlushScratchSpace:
+	{
+		ScopedTraceSlice slice("flush_scratch");
+		reset_memory_loc();
+		reset_tag_usage();
+		set_padding_bytes(0);
+		profile_release_all();
+
+		//flushed scratch is dead - overflow can go straight back
+		release_overflow();
+
+		//reset our memory usage to find size of active allocations only
+		if (get_maxSpaceUsed() > get_lastMaxSpaceUsed())
+		{
+			set_lastMaxSpaceUsed(get_maxSpaceUsed());
+		}
+
+		set_maxSpaceUsed(0);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+StackAllocator::~StackAllocator() {
+	//log stats
+#if DATALOGGING_ON == 1
+	std::string name = "Stack Allocator: ";
+	switch (get_memoryType())
+	{
+	case MemoryMappingType::kCPU:
+		name += "CPU";
+		break;
+	case MemoryMappingType::kGPU:
+		name += "GPU";
+		break;
+	default:
+		name += "UNDEFINED";
+		break;
+	}
+	output_all_data(name.c_str());
+
+	std::ofstream datalog("datalog.csv", std::fstream::app);
+	datalog << "memory size:," << get_memorySize() << ",\n"
+		<< "space remaining:," << get_spaceRemaining() << ",\n"
+		<< "overflow events:," << overflowCount << ",\n"
+		<< "overflow peak:," << overflowBytesPeak << ",\n\n";
+	datalog.close();
+
+#endif
+	//release whole chunk of memory
+	release_overflow();
+	release_spare_overflow();
+	if (memblock != nullptr)
+	{
+		unmap_image_pages();
+		release_system_region(memblock);
+	}
+}
+
+void StackAllocator::unmap_image_pages() {
+	if (!imageMapEnd)
+		return;
+
+#if defined(__linux__)
+	//the broker hands these pages out again - unwritten pages of a private file mapping still follow the file
+	size_t pageSize = get_page_size();
+	uint8_t* start = (uint8_t*)(((uintptr_t)memblock + pageSize - 1) & ~(uintptr_t)(pageSize - 1));
+	mmap(start, imageMapEnd - start, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+#endif
+	imageMapEnd = nullptr;
+}
+#pragma endregion
+
+#pragma region Stack Allocator - With Marker Rollback
+void RollbackStackAllocator::rollback_to_marker(){
+	SHU_ASSERT(get_marker() != nullptr);
+	ScopedTraceSlice slice("rollback_to_marker");
+
+	//find how much space we will have left when reset and set it
+	ptrdiff_t diff = get_memLoc() - get_marker();
+	set_spaceRemaining(get_spaceRemaining() + diff);
+
+	//set active memory location to the marker we placed
+	set_memLoc(get_marker());
+
+	//everything above the marker is gone - so is what it was charged to
+	restore_tag_usage(markerTagUsage);
+	set_padding_bytes(markerPadding);
+	drop_relocations(get_marker());
+	profile_release_range(get_marker(), diff);
+	rollback_overflow(markerOverflow);
+}
+
+void RollbackStackAllocator::release_sized(void* ptr, size_t size, size_t alignment) {
+	//popping under the marker would leave it above the top
+	if (rollback_marker && (uint8_t*)ptr < rollback_marker)
+	{
+		release(ptr);
+		return;
+	}
+	StackAllocator::release_sized(ptr, size, alignment);
+}
+
+void RollbackStackAllocator::save_snapshot_state(std::vector<uint8_t>& state) const {
+	StackAllocator::save_snapshot_state(state);
+	put_state(state, rollback_marker);
+	put_state(state, markerTagUsage);
+	put_state(state, markerOverflow);
+	put_state(state, markerPadding);
+}
+
+bool RollbackStackAllocator::restore_snapshot_state(const uint8_t*& state, bool checkOnly) {
+	if (!StackAllocator::restore_snapshot_state(state, checkOnly))
+		return false;
+
+	uint8_t* marker = get_state<uint8_t*>(state);
+	const uint8_t* tagUsage = state;
+	state += sizeof(markerTagUsage);
+	overflowMark mark = get_state<overflowMark>(state);
+	size_t padding = get_state<size_t>(state);
+	if (!checkOnly)
+	{
+		rollback_marker = marker;
+		memcpy(markerTagUsage, tagUsage, sizeof(markerTagUsage));
+		markerOverflow = mark;
+		markerPadding = padding;
+	}
+	return true;
+}
+
+void RollbackStackAllocator::handle_signals(GameEventType sig) {
+	switch (sig)
+	{
+	case GameEventType::kEventLevelBeginLoad:
+		place_marker();
+		break;
+	case GameEventType::kEventLevelUnload:
+		rollback_to_marker();
+		break;
+	default:
+		break;
+	}
+}
+#pragma endregion
+
+#pragma region CPU Stack Allocator - UNUSED AS BASE HAS BEEN EXTENDED
+void* CPUStackAllocator::allocate(size_t size, size_t alignment) {
+
+	//if no memory grabbed - get it
+	if (!get_memblock())
+	{
+		//reset_memory_loc hands out memorySize, so the block has to be that big
+		size_t blocksize = get_memorySize();
+		set_memblock((uint8_t*)acquire_system_region(blocksize, MemoryMappingType::kCPU));
+
+		reset_memory_loc();
+	}
+
+	size_t sR = get_spaceRemaining();
+	void* ret_p = nullptr;
+
+	//align the first element
+	void* pCur = (void*)get_memLoc();
+	ret_p = std::align(alignment, size, pCur, sR);
+
+	//test for memory used up
+	SHU_ASSERT(ret_p != nullptr)
+	SHU_ASSERT((sR) >= size)
+
+	set_spaceRemaining(sR);
+
+	//check if is in cpu space
+	SHU_ASSERT(is_within_mapped_block(get_memLoc(), MemoryMappingType::kCPU))
+
+	set_memLoc((uint8_t*)ret_p + size);	//inc memory address by size for next time
+
+	//log stats
+#if DATALOGGING_ON == 1
+	measure_usage(size);
+#endif
+	return ret_p;
+}
+
+void CPUStackAllocator::release(void* /*ptr*/) {
+	//same as the base - ptr is a user pointer, not the block
+}
+
+CPUStackAllocator::~CPUStackAllocator(){
+	//log stats
+#if DATALOGGING_ON == 1
+	output_all_data("CPU Stack Allocator");
+#endif
+}
+#pragma endregion
+
+#pragma region Multi / Active Frame Stack Allocator 
+void* MultiFrameAllocator::allocate(size_t size, size_t alignment) {
+
+	//if no memory grabbed - get it, the system may have none left for a main block but can still chain overflow
+	if (!ensure_main_block())
+		return allocate_overflow(size, alignment);
+
+	size_t sR = get_spaceRemaining();
+	void* ret_p = nullptr;
+
+	//align the first element
+	void* pCur = (void*)get_memLoc();
+	ret_p = std::align(alignment, size, pCur, sR);
+
+	//main block is used up - chain on to overflow rather than fall over
+	if (ret_p == nullptr)
+		return allocate_overflow(size, alignment);
+	SHU_ASSERT((sR) >= size)
+
+	//over a hard budget for this tag - refuse without touching the stack
+	AllocTag tag = get_current_alloc_tag();
+	if (!charge_tag(tag, size))
+		return nullptr;
+
+	//std::align only takes off the padding, take the allocation off too
+	set_spaceRemaining(sR - size);
+
+	//check if is in cpu space
+	SHU_ASSERT(is_within_mapped_block(get_memLoc(), get_memoryType()))
+
+	//measure alignment offset
+	ptrdiff_t alignOffset = (uint8_t*)ret_p - get_memLoc();
+	add_padding(alignOffset);
+
+	//inc memory address by size for next time
+	push_top_allocation(ret_p, size, alignOffset, tag);
+
+	//log stats
+#if DATALOGGING_ON == 1
+	measure_usage(alignOffset + size);
+#endif
+	profile_allocation(ret_p, size);
+	return ret_p;
+}
+
+void MultiFrameAllocator::handle_signals(GameEventType s)
+{
+	switch (s)
+	{
+	case GameEventType::kEventNextFrame:
+		//how many frames do we want active data
+		//loop back to buffer start when we hit that
+		inc_frame_count();
+		if (get_frame_count() > 3)
+		{
+			ScopedTraceSlice slice("frame_ring_wrap");
+			reset_memory_loc();
+			reset_frame_count();
+			reset_tag_usage();
+			set_padding_bytes(0);
+			profile_release_all();
+
+			//this cycle's overflow may still be read for a few frames - free it next wrap
+			retire_overflow();
+
+			//reset our memory usage to find size of active allocations only
+			if (get_maxSpaceUsed() > get_lastMaxSpaceUsed())
+			{
+				set_lastMaxSpaceUsed(get_maxSpaceUsed());
+			}
+
+			set_maxSpaceUsed(0);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void MultiFrameAllocator::save_snapshot_state(std::vector<uint8_t>& state) const
+{
+	StackAllocator::save_snapshot_state(state);
+	put_state(state, frameCount);
+}
+
+bool MultiFrameAllocator::restore_snapshot_state(const uint8_t*& state, bool checkOnly)
+{
+	if (!StackAllocator::restore_snapshot_state(state, checkOnly))
+		return false;
+
+	size_t frames = get_state<size_t>(state);
+	if (!checkOnly)
+		frameCount = frames;
+	return true;
+}
+
+MultiFrameAllocator::~MultiFrameAllocator() {
+	//log stats
+#if DATALOGGING_ON == 1
+	std::string name = "Ring Allocator: ";
+	switch (get_memoryType())
+	{
+	case MemoryMappingType::kCPU:
+		name += "CPU";
+		break;
+	case MemoryMappingType::kGPU:
+		name += "GPU";
+		break;
+	default:
+		name += "UNDEFINED";
+		break;
+	}
+	output_all_data(name.c_str());
+#endif
+}
+#pragma endregion
+
+#pragma region CPU MF Allocator - UNUSED
+void* CPUMFAllocator::allocate(size_t size, size_t alignment) {
+
+	//if no memory grabbed - get it
+	if (!get_memblock())
+	{
+		//reset_memory_loc hands out memorySize, so the block has to be that big
+		size_t blocksize = get_memorySize();
+		set_memblock((uint8_t*)acquire_system_region(blocksize, MemoryMappingType::kCPU));
+
+		reset_memory_loc();
+	}
+
+	size_t sR = get_spaceRemaining();
+	void* ret_p = nullptr;
+
+	//align the first element
+	void* pCur = (void*)get_memLoc();
+	ret_p = std::align(alignment, size, pCur, sR);
+
+	//test for memory used up
+	SHU_ASSERT(ret_p != nullptr)
+	SHU_ASSERT((sR) >= size)
+
+	set_spaceRemaining(sR);
+
+	//check if is in cpu space
+	SHU_ASSERT(is_within_mapped_block(get_memLoc(), MemoryMappingType::kCPU))
+
+	set_memLoc((uint8_t*)ret_p + size);	//inc memory address by size for next time
+
+		//log stats
+#if DATALOGGING_ON == 1
+	measure_usage(size);
+#endif
+	return ret_p;
+}
+
+void CPUMFAllocator::handle_signals(GameEventType s)
+{
+	switch (s)
+	{
+	case GameEventType::kEventNextFrame:
+		//how many frames do we want active data
+		//loop back to buffer start when we hit that
+		inc_frame_count();
+		if (get_frame_count() > 3)
+		{
+			ScopedTraceSlice slice("frame_ring_wrap");
+			reset_memory_loc();
+			reset_frame_count();
+			reset_tag_usage();
+			set_padding_bytes(0);
+			profile_release_all();
+
+			//this cycle's overflow may still be read for a few frames - free it next wrap
+			retire_overflow();
+
+			//reset our memory usage to find size of active allocations only
+			if (get_maxSpaceUsed() > get_lastMaxSpaceUsed())
+			{
+				set_lastMaxSpaceUsed(get_maxSpaceUsed());
+			}
+
+			set_maxSpaceUsed(0);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+CPUMFAllocator::~CPUMFAllocator() {
+	//log stats
+#if DATALOGGING_ON == 1
+	//const char* classname = __CLASS__;
+	output_all_data("CPU Ring Allocator");
+
+	std::ofstream datalog("datalog.csv", std::fstream::app);
+	datalog << "space remaining:," << get_spaceRemaining() << ",\n\n";
+	datalog.close();
+
+#endif
+}
+#pragma endregion
+
+#pragma region Free List Allocator - DRAFT IDEA SMALL OBJECT TEST
+//void * ObjectPoolManager::allocate(size_t size, size_t alignment)
 //{
 //	//if no memory grabbed - get it
 //	if (!get_memblock())
@@ -580,7 +2413,7 @@ GPUMFAllocator::~GPUMFAllocator() {
 //		//TEST MEMORY SIZE
 //		int blocksize = get_memorySize();
 //		set_spaceRemaining(blocksize);
-//		set_memblock((uint8_t*)allocate_system_block(blocksize, get_memoryType()));
+//		set_memblock((uint8_t*)acquire_system_region(blocksize, get_memoryType()));
 //
 //		reset_memory_loc();
 //
@@ -657,104 +2490,2730 @@ GPUMFAllocator::~GPUMFAllocator() {
 //}
 #pragma endregion
 
-#pragma region Object Pool
-constexpr size_t kDSize = sizeof(ObjectPoolManager::dataPack);
-constexpr size_t kMemOffset = offsetof(ObjectPoolManager::dataPack, d);
+#pragma region Object Pool
+constexpr size_t kDSize = sizeof(ObjectPoolManager::dataPack);
+constexpr size_t kDAlign = alignof(ObjectPoolManager::dataPack);
+static_assert(kDSize == 64, "pool slots should be exactly one cache line");
+constexpr size_t kSlabHeaderSize = sizeof(ObjectPoolManager::poolSlab);
+//bitmaps are padded to whole AVX2 loads (4 words)
+constexpr size_t kBitmapWordPad = 4;
+constexpr uint64_t kFullWord = ~uint64_t(0);
+constexpr size_t kNoFreeBit = ~size_t(0);
+
+//index of the lowest set bit - v must not be 0
+static inline size_t bit_scan_forward(uint64_t v)
+{
+#if defined(_MSC_VER)
+	unsigned long i;
+	_BitScanForward64(&i, v);
+	return i;
+#else
+	return __builtin_ctzll(v);
+#endif
+}
+
+static inline size_t pop_count(uint64_t v)
+{
+#if defined(_MSC_VER)
+	return __popcnt64(v);
+#else
+	return __builtin_popcountll(v);
+#endif
+}
+
+//find the first clear bit at or after word startWord
+//skips full words 4 (AVX2) or 2 (SSE2) at a time before the scalar scan
+static size_t find_first_zero_bit(const uint64_t* words, size_t wordCount, size_t startWord)
+{
+	size_t w = startWord;
+#if defined(__AVX2__)
+	const __m256i ones = _mm256_set1_epi64x(-1);
+	for (; w + 4 <= wordCount; w += 4)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(words + w));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(v, ones)) != -1)
+			break;
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	const __m128i ones = _mm_set1_epi32(-1);
+	for (; w + 2 <= wordCount; w += 2)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(words + w));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, ones)) != 0xFFFF)
+			break;
+	}
+#endif
+	for (; w < wordCount; ++w)
+	{
+		if (words[w] != kFullWord)
+			return w * 64 + bit_scan_forward(~words[w]);
+	}
+	return kNoFreeBit;
+}
+
+static size_t count_bits(const uint64_t* words, size_t wordCount)
+{
+	size_t count(0);
+	for (size_t w(0); w < wordCount; ++w)
+		count += pop_count(words[w]);
+	return count;
+}
+
+//live bits at or past the watermark are left over from before a reset, or never written
+static inline bool is_pack_live(const ObjectPoolManager::poolSlab* slab, size_t index)
+{
+	return index < slab->watermark && (slab->liveBits[index / 64] & (uint64_t(1) << (index % 64)));
+}
+
+static size_t count_live_packs(const ObjectPoolManager::poolSlab* slab)
+{
+	size_t fullWords = slab->watermark / 64;
+	size_t count = count_bits(slab->liveBits, fullWords);
+	if (slab->watermark % 64)
+		count += pop_count(slab->liveBits[fullWords] & ((uint64_t(1) << (slab->watermark % 64)) - 1));
+	return count;
+}
+
+//the first slab is the main block
+bool ObjectPoolManager::ensure_main_block()
+{
+	if (!get_memblock())
+	{
+		poolSlab* slab = create_slab(MaxAllocations);
+		if (!slab)
+			return false;
+
+		set_memblock((uint8_t*)slab);
+		reset_memory_loc();
+	}
+	return true;
+}
+
+void* ObjectPoolManager::allocate(size_t size, size_t alignment)
+{
+		//if no memory grabbed - get it
+		if (!ensure_main_block())
+			return nullptr;
+
+		//slots are fixed size and cache line aligned - cant help with anything else
+		if (size > kDSize || alignment > kDAlign)
+			return nullptr;
+
+		//over a hard budget for this tag
+		AllocTag tag = get_current_alloc_tag();
+		if (!charge_tag(tag, kDSize))
+			return nullptr;
+
+		//find our first free element - grows the pool if we are full
+		poolSlab* slab = nullptr;
+		uint8_t* ret_p = (uint8_t*)add_data(slab);
+
+		//out of slabs and the system wont give us more
+		if (!ret_p)
+		{
+			refund_tag(tag, kDSize);
+			return nullptr;
+		}
+
+		if (++liveCount > liveHighWater)
+			liveHighWater = liveCount;
+
+		//remember who asked for it
+		size_t index = (dataPack*)ret_p - slab->packs;
+		slab->tags[index] = tag;
+
+		//rest of the pack is slot slack
+		slab->slack[index] = (uint8_t)(kDSize - size);
+		add_padding(kDSize - size);
+
+		//check if is in chosen space and in range
+		SHU_ASSERT(is_within_mapped_block(ret_p, get_memoryType()));
+
+		profile_allocation(ret_p, kDSize);
+		return ret_p;
+}
+
+void ObjectPoolManager::release(void * ptr)
+{
+	//slots have no header, the pointer is the pack
+	dataPack* dpp = (dataPack*)ptr;
+
+	poolSlab* slab = find_slab(dpp);
+	SHU_ASSERT(slab != nullptr);
+
+	//clear the live bit - must have been live
+	size_t index = dpp - slab->packs;
+	size_t word = index / 64;
+	uint64_t bit = uint64_t(1) << (index % 64);
+	SHU_ASSERT(is_pack_live(slab, index));
+	slab->liveBits[word] &= ~bit;
+	--liveCount;
+
+	refund_tag(slab->tags[index], kDSize);
+	remove_padding(slab->slack[index]);
+	profile_release(ptr);
+
+	//free space below the hint - search from here next time
+	if (word < slab->searchHint)
+		slab->searchHint = word;
+}
+
+bool ObjectPoolManager::try_expand(void* ptr, size_t newSize)
+{
+	if (newSize > kDSize)
+		return false;
+
+	//less slack left in the pack
+	poolSlab* slab = find_slab(ptr);
+	SHU_ASSERT(slab != nullptr);
+	size_t index = (dataPack*)ptr - slab->packs;
+	remove_padding(slab->slack[index]);
+	slab->slack[index] = (uint8_t)(kDSize - newSize);
+	add_padding(kDSize - newSize);
+	return true;
+}
+
+void ObjectPoolManager::handle_signals(GameEventType sig)
+{
+	switch (sig)
+	{
+	case GameEventType::kEventLevelUnload:	//good time to hand back spare slabs
+		shrink_slabs();
+		break;
+	default:
+		break;
+	}
+}
+
+void ObjectPoolManager::reset()
+{
+	//the watermarks say everything is free - stale live bits below them are never read
+	for (poolSlab* slab = firstSlab; slab; slab = slab->next)
+	{
+		slab->watermark = 0;
+		slab->searchHint = 0;
+	}
+
+	liveCount = 0;
+	reset_tag_usage();
+	set_padding_bytes(0);
+	profile_release_all();
+}
+
+void ObjectPoolManager::shrink_slabs()
+{
+	ScopedTraceSlice slice("shrink_slabs");
+	//never release the first slab, that is our base capacity
+	if (!firstSlab)
+		return;
+
+	poolSlab* prevSlab = firstSlab;
+	poolSlab* slab = firstSlab->next;
+	while (slab)
+	{
+		poolSlab* nextSlab = slab->next;
+
+		//nothing live in it - drop the slab from the chain and give it back
+		if (count_live_packs(slab) == 0)
+		{
+			prevSlab->next = nextSlab;
+			--slabCount;
+			release_system_region(slab);
+		}
+		else
+		{
+			prevSlab = slab;
+		}
+
+		slab = nextSlab;
+	}
+}
+
+void ObjectPoolManager::gather_fragmentation(fragmentationStats& stats) const
+{
+	IMemoryAllocatorX::gather_fragmentation(stats);
+
+	//runs of free packs
+	for (poolSlab* slab = firstSlab; slab; slab = slab->next)
+	{
+		size_t run(0);
+		for (size_t i(0); i < slab->capacity; ++i)
+		{
+			if (is_pack_live(slab, i))
+			{
+				stats.add_free_extent(run * kDSize);
+				run = 0;
+			}
+			else
+			{
+				++run;
+			}
+		}
+		stats.add_free_extent(run * kDSize);
+	}
+}
+
+void ObjectPoolManager::gather_layout(std::vector<layoutRegion>& regions) const
+{
+	//one granule per pack
+	for (poolSlab* slab = firstSlab; slab; slab = slab->next)
+	{
+		layoutRegion region;
+		region.base = slab->packs;
+		region.size = slab->capacity * kDSize;
+		region.granule = (uint32_t)kDSize;
+		region.occupancy.resize(slab->capacity);
+		for (size_t i(0); i < slab->capacity; ++i)
+			region.occupancy[i] = is_pack_live(slab, i) ? 255 : 0;
+		regions.push_back(std::move(region));
+	}
+}
+
+bool ObjectPoolManager::get_snapshot_regions(std::vector<snapshotRegion>& regions) const
+{
+	//nothing past the watermark holds anything, so only the header and the packs below it
+	for (poolSlab* slab = firstSlab; slab; slab = slab->next)
+		regions.push_back({ (uint8_t*)slab, (size_t)((uint8_t*)(slab->packs + slab->watermark) - (uint8_t*)slab) });
+	return true;
+}
+
+void ObjectPoolManager::save_snapshot_state(std::vector<uint8_t>& state) const
+{
+	//the stack part of us is unused, only the base bookkeeping matters
+	IMemoryAllocatorX::save_snapshot_state(state);
+	put_state(state, slabCount);
+	for (poolSlab* slab = firstSlab; slab; slab = slab->next)
+		put_state(state, slab);
+}
+
+bool ObjectPoolManager::restore_snapshot_state(const uint8_t*& state, bool checkOnly)
+{
+	if (!IMemoryAllocatorX::restore_snapshot_state(state, checkOnly))
+		return false;
+
+	//same slabs in the same order - the chain links themselves come back with the slab memory
+	size_t count = get_state<size_t>(state);
+	bool matches = (count == slabCount);
+	poolSlab* slab = firstSlab;
+	for (size_t i(0); i < count; ++i)
+	{
+		poolSlab* saved = get_state<poolSlab*>(state);
+		matches = matches && (slab == saved);
+		slab = slab ? slab->next : nullptr;
+	}
+
+	//the bitmaps came back with the slabs
+	if (matches && !checkOnly)
+		liveCount = get_live_count();
+	return matches;
+}
+
+size_t ObjectPoolManager::get_live_count() const
+{
+	size_t count(0);
+	for (poolSlab* slab = firstSlab; slab; slab = slab->next)
+		count += count_live_packs(slab);
+	return count;
+}
+
+size_t ObjectPoolManager::get_used_count() const
+{
+	size_t count(0);
+	for (poolSlab* slab = firstSlab; slab; slab = slab->next)
+		count += slab->usedCount;
+	return count;
+}
+
+size_t ObjectPoolManager::get_capacity() const
+{
+	size_t count(0);
+	for (poolSlab* slab = firstSlab; slab; slab = slab->next)
+		count += slab->capacity;
+	return count;
+}
+
+ObjectPoolManager::~ObjectPoolManager()
+{
+#if DATALOGGING_ON == 1
+	output_all_data("Object Pool Allocator");
+
+	std::ofstream datalog("datalog.csv", std::fstream::app);
+	datalog << "used nodes:," << get_used_count() << ",\n"
+	<< "max nodes:," << get_capacity() << ",\n"
+	<< "slabs:," << slabCount << ",\n\n";
+	datalog.close();
+#endif
+
+	//give back every slab we own
+	poolSlab* slab = firstSlab;
+	while (slab)
+	{
+		poolSlab* nextSlab = slab->next;
+		release_system_region(slab);
+		slab = nextSlab;
+	}
+	firstSlab = nullptr;
+	set_memblock(nullptr);
+}
+
+ObjectPoolManager::dataPack* ObjectPoolManager::add_data(poolSlab*& slab)
+{
+	// Lowest recycled pack in the lowest slab that has one, otherwise bump its watermark.
+	size_t index = kNoFreeBit;
+	for (slab = firstSlab; slab; slab = slab->next)
+	{
+		//recycled packs are all below the watermark - a free bit at or past it isnt one
+		size_t searchWords = (slab->watermark + 63) / 64;
+		if (slab->searchHint < searchWords)
+		{
+			index = find_first_zero_bit(slab->liveBits, searchWords, slab->searchHint);
+			if (index < slab->watermark)
+				break;
+		}
+		//nothing to recycle - dont search below the watermark's word again until something is released
+		slab->searchHint = slab->watermark / 64;
+
+		if (slab->watermark < slab->capacity)
+		{
+			index = slab->watermark++;
+			if (slab->watermark > slab->usedCount)
+				slab->usedCount = slab->watermark;
+			break;
+		}
+	}
+
+	// Pool is full - chain on another slab.
+	if (!slab)
+	{
+		slab = create_slab(SlabAllocations);
+		if (!slab)
+			return nullptr;
+		index = slab->watermark++;
+		slab->usedCount = slab->watermark;
+	}
+
+	// Mark it live.
+	size_t word = index / 64;
+	slab->liveBits[word] |= uint64_t(1) << (index % 64);
+	slab->searchHint = word;
+
+	return &slab->packs[index];
+}
+
+ObjectPoolManager::poolSlab* ObjectPoolManager::create_slab(size_t allocs)
+{
+	SHU_ASSERT(allocs > 0);
+
+	//header, live bitmap, tags, slack, then the packs on a cache line boundary
+	size_t wordCount = (((allocs + 63) / 64) + kBitmapWordPad - 1) & ~(kBitmapWordPad - 1);
+	size_t bitmapSize = wordCount * sizeof(uint64_t);
+	size_t tagOffset = kSlabHeaderSize + bitmapSize;
+	size_t slackOffset = tagOffset + allocs * sizeof(AllocTag);
+	size_t packOffset = (slackOffset + allocs * sizeof(uint8_t) + kDAlign - 1) & ~(kDAlign - 1);
+	size_t blocksize = packOffset + allocs * kDSize;
+
+	uint8_t* block = (uint8_t*)acquire_system_region(blocksize, get_memoryType(), get_numaNode());
+	if (!block)
+		return nullptr;
+
+	poolSlab* slab = new(block) poolSlab;
+	slab->capacity = allocs;
+	slab->wordCount = wordCount;
+	slab->liveBits = (uint64_t*)(block + kSlabHeaderSize);
+	slab->tags = (AllocTag*)(block + tagOffset);
+	slab->slack = block + slackOffset;
+	slab->blockSize = blocksize;
+	slab->packs = (dataPack*)(block + packOffset);
+
+	//everything free with the watermark at 0 - the bitmap is left as it came and filled in as packs go out
+
+	//append to the end of the chain so the first slab stays first
+	if (!firstSlab)
+	{
+		firstSlab = slab;
+	}
+	else
+	{
+		poolSlab* last = firstSlab;
+		while (last->next)
+			last = last->next;
+		last->next = slab;
+	}
+	++slabCount;
+
+	return slab;
+}
+
+ObjectPoolManager::poolSlab* ObjectPoolManager::find_slab(const void* ptr)
+{
+	uintptr_t p = reinterpret_cast<uintptr_t>(ptr);
+	for (poolSlab* slab = firstSlab; slab; slab = slab->next)
+	{
+		uintptr_t s = reinterpret_cast<uintptr_t>(slab->packs);
+		uintptr_t e = reinterpret_cast<uintptr_t>(slab->packs + slab->capacity);
+		if ((s <= p) && (p < e))
+			return slab;
+	}
+	return nullptr;
+}
+#pragma endregion
+
+#pragma region NUMA Local Allocator
+void* NumaLocalAllocator::allocate(size_t size, size_t alignment)
+{
+	void* ret_p = get_allocating_node()->allocate(size, alignment);
+	if (ret_p)
+		update_tag_peak();
+	return ret_p;
+}
+
+void* NumaLocalAllocator::allocate_zeroed(size_t size, size_t alignment)
+{
+	void* ret_p = get_allocating_node()->allocate_zeroed(size, alignment);
+	if (ret_p)
+		update_tag_peak();
+	return ret_p;
+}
+
+void NumaLocalAllocator::release(void* ptr)
+{
+	//usually released on the node it came from - check that one first
+	StackAllocator* local = nodeAllocators[get_current_numa_node()];
+	if (local && local->owns(ptr))
+	{
+		local->release(ptr);
+		return;
+	}
+
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		if (nodeAllocators[i] && nodeAllocators[i]->owns(ptr))
+		{
+			nodeAllocators[i]->release(ptr);
+			return;
+		}
+	}
+
+	//not ours
+	SHU_ASSERT(false);
+}
+
+bool NumaLocalAllocator::try_expand(void* ptr, size_t newSize)
+{
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		if (nodeAllocators[i] && nodeAllocators[i]->owns(ptr))
+		{
+			if (!nodeAllocators[i]->try_expand(ptr, newSize))
+				return false;
+			update_tag_peak();
+			return true;
+		}
+	}
+	return false;
+}
+
+void NumaLocalAllocator::release_sized(void* ptr, size_t size, size_t alignment)
+{
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		if (nodeAllocators[i] && nodeAllocators[i]->owns(ptr))
+		{
+			nodeAllocators[i]->release_sized(ptr, size, alignment);
+			return;
+		}
+	}
+
+	//not ours
+	SHU_ASSERT(false);
+}
+
+void NumaLocalAllocator::handle_signals(GameEventType sig)
+{
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		if (nodeAllocators[i])
+			nodeAllocators[i]->handle_signals(sig);
+	}
+}
+
+bool NumaLocalAllocator::owns(const void* ptr)
+{
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		if (nodeAllocators[i] && nodeAllocators[i]->owns(ptr))
+			return true;
+	}
+	return false;
+}
+
+void NumaLocalAllocator::for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const
+{
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		if (nodeAllocators[i])
+			fn(nodeAllocators[i]);
+	}
+}
+
+size_t NumaLocalAllocator::node_share(size_t budget)
+{
+	//only as many shares as there are nodes to use them - rounded up so a small budget isnt 0 (no budget)
+	int nodes = get_numa_node_count() < kMaxNumaNodes ? get_numa_node_count() : kMaxNumaNodes;
+	return (budget + nodes - 1) / nodes;
+}
+
+void NumaLocalAllocator::set_tag_budget(AllocTag tag, size_t softBudget, size_t hardBudget)
+{
+	//the whole budget is kept here for node instances made later
+	set_own_tag_budget(tag, softBudget, hardBudget);
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		if (nodeAllocators[i])
+			nodeAllocators[i]->set_tag_budget(tag, node_share(softBudget), node_share(hardBudget));
+	}
+}
+
+size_t NumaLocalAllocator::get_tag_peak(AllocTag tag) const
+{
+	return tagPeaks[(size_t)tag];
+}
+
+//allocations are charged to the current tag, so that is the only one that can have gone up
+void NumaLocalAllocator::update_tag_peak()
+{
+	AllocTag tag = get_current_alloc_tag();
+	size_t used = get_tag_usage(tag);
+	if (used > tagPeaks[(size_t)tag])
+		tagPeaks[(size_t)tag] = used;
+}
+
+//no node used yet is an empty checkpoint, not a malloc backed one
+bool NumaLocalAllocator::get_snapshot_regions(std::vector<snapshotRegion>& regions) const
+{
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		if (nodeAllocators[i] && !nodeAllocators[i]->get_snapshot_regions(regions))
+			return false;
+	}
+	return true;
+}
+
+void NumaLocalAllocator::save_snapshot_state(std::vector<uint8_t>& state) const
+{
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		put_state(state, nodeAllocators[i] != nullptr);
+		if (nodeAllocators[i])
+			nodeAllocators[i]->save_snapshot_state(state);
+	}
+}
+
+bool NumaLocalAllocator::restore_snapshot_state(const uint8_t*& state, bool checkOnly)
+{
+	//a node instance made after the capture has nothing to go back to
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		bool hadNode = get_state<bool>(state);
+		if (hadNode != (nodeAllocators[i] != nullptr))
+			return false;
+		if (hadNode && !nodeAllocators[i]->restore_snapshot_state(state, checkOnly))
+			return false;
+	}
+	return true;
+}
+
+StackAllocator* NumaLocalAllocator::get_node_allocator(int node)
+{
+	SHU_ASSERT(node >= 0 && node < kMaxNumaNodes);
+
+	if (!nodeAllocators[node])
+	{
+		nodeAllocators[node] = createAllocator();
+		//only bind when there is more than one node to choose from
+		if (get_numa_node_count() > 1)
+			nodeAllocators[node]->set_numaNode(node);
+
+		//hand down its share of any budgets set before this node was first used
+		for (size_t t(0); t < (size_t)AllocTag::kMaxTags; ++t)
+		{
+			size_t soft, hard;
+			get_tag_budget((AllocTag)t, soft, hard);
+			nodeAllocators[node]->set_tag_budget((AllocTag)t, node_share(soft), node_share(hard));
+		}
+		nodeAllocators[node]->set_budget_callback(get_budget_callback());
+		if (get_heap_profile_interval())
+			nodeAllocators[node]->enable_heap_profile(get_heap_profile_interval());
+	}
+	return nodeAllocators[node];
+}
+
+StackAllocator* NumaLocalAllocator::get_allocating_node()
+{
+	StackAllocator* local = get_node_allocator(get_current_numa_node());
+	if (local->ensure_main_block())
+		return local;
+
+	//every node getting its own block can run the system out - remote memory beats none
+	//the local instance is kept and tries again next time, memory may have been given back by then
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		if (nodeAllocators[i] && nodeAllocators[i]->get_memblock())
+			return nodeAllocators[i];
+	}
+
+	//nobody has memory - the local one can still try to chain overflow
+	return local;
+}
+
+NumaLocalAllocator::~NumaLocalAllocator()
+{
+	for (int i(0); i < kMaxNumaNodes; ++i)
+	{
+		delete nodeAllocators[i];
+		nodeAllocators[i] = nullptr;
+	}
+}
+#pragma endregion
+
+#pragma region Allocator Combinators
+void* FallbackAllocator::allocate(size_t size, size_t alignment)
+{
+	void* ret_p = primaryAllocator->allocate(size, alignment);
+	if (!ret_p)
+		ret_p = fallbackAllocator->allocate(size, alignment);
+	return ret_p;
+}
+
+void* FallbackAllocator::allocate_zeroed(size_t size, size_t alignment)
+{
+	void* ret_p = primaryAllocator->allocate_zeroed(size, alignment);
+	if (!ret_p)
+		ret_p = fallbackAllocator->allocate_zeroed(size, alignment);
+	return ret_p;
+}
+
+void FallbackAllocator::release(void* ptr)
+{
+	if (primaryAllocator->owns(ptr))
+		primaryAllocator->release(ptr);
+	else
+		fallbackAllocator->release(ptr);
+}
+
+void FallbackAllocator::release_sized(void* ptr, size_t size, size_t alignment)
+{
+	if (primaryAllocator->owns(ptr))
+		primaryAllocator->release_sized(ptr, size, alignment);
+	else
+		fallbackAllocator->release_sized(ptr, size, alignment);
+}
+
+bool FallbackAllocator::try_expand(void* ptr, size_t newSize)
+{
+	if (primaryAllocator->owns(ptr))
+		return primaryAllocator->try_expand(ptr, newSize);
+	return fallbackAllocator->try_expand(ptr, newSize);
+}
+
+void FallbackAllocator::handle_signals(GameEventType sig)
+{
+	primaryAllocator->handle_signals(sig);
+	if (fallbackAllocator != primaryAllocator)
+		fallbackAllocator->handle_signals(sig);
+}
+
+bool FallbackAllocator::owns(const void* ptr)
+{
+	return primaryAllocator->owns(ptr) || fallbackAllocator->owns(ptr);
+}
+
+void FallbackAllocator::for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const
+{
+	fn(primaryAllocator);
+	if (fallbackAllocator != primaryAllocator)
+		fn(fallbackAllocator);
+}
+
+void* SegregatorAllocator::allocate(size_t size, size_t alignment)
+{
+	if (size <= sizeThreshold)
+		return smallAllocator->allocate(size, alignment);
+	return largeAllocator->allocate(size, alignment);
+}
+
+void* SegregatorAllocator::allocate_zeroed(size_t size, size_t alignment)
+{
+	if (size <= sizeThreshold)
+		return smallAllocator->allocate_zeroed(size, alignment);
+	return largeAllocator->allocate_zeroed(size, alignment);
+}
+
+void SegregatorAllocator::release(void* ptr)
+{
+	//no size on release - ask the small side if it's theirs
+	if (smallAllocator->owns(ptr))
+		smallAllocator->release(ptr);
+	else
+		largeAllocator->release(ptr);
+}
+
+void SegregatorAllocator::release_sized(void* ptr, size_t size, size_t alignment)
+{
+	//with the size we know the route without asking owns()
+	if (size <= sizeThreshold)
+		smallAllocator->release_sized(ptr, size, alignment);
+	else
+		largeAllocator->release_sized(ptr, size, alignment);
+}
+
+bool SegregatorAllocator::try_expand(void* ptr, size_t newSize)
+{
+	//only within a side - sized release routes on size, so crossing the threshold has to move
+	if (smallAllocator->owns(ptr))
+		return newSize <= sizeThreshold && smallAllocator->try_expand(ptr, newSize);
+	return newSize > sizeThreshold && largeAllocator->try_expand(ptr, newSize);
+}
+
+void SegregatorAllocator::handle_signals(GameEventType sig)
+{
+	smallAllocator->handle_signals(sig);
+	if (largeAllocator != smallAllocator)
+		largeAllocator->handle_signals(sig);
+}
+
+bool SegregatorAllocator::owns(const void* ptr)
+{
+	return smallAllocator->owns(ptr) || largeAllocator->owns(ptr);
+}
+
+void SegregatorAllocator::for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const
+{
+	fn(smallAllocator);
+	if (largeAllocator != smallAllocator)
+		fn(largeAllocator);
+}
+
+void BucketizerAllocator::add_bucket(size_t maxSize, IMemoryAllocatorX* allocator)
+{
+	SHU_ASSERT(bucketCount < kMaxBuckets);
+	SHU_ASSERT(bucketCount == 0 || buckets[bucketCount - 1].maxSize < maxSize);
+
+	buckets[bucketCount].maxSize = maxSize;
+	buckets[bucketCount].allocator = allocator;
+	++bucketCount;
+}
+
+void* BucketizerAllocator::allocate(size_t size, size_t alignment)
+{
+	for (size_t i(0); i < bucketCount; ++i)
+	{
+		if (size <= buckets[i].maxSize)
+			return buckets[i].allocator->allocate(size, alignment);
+	}
+	//bigger than every bucket
+	return nullptr;
+}
+
+void* BucketizerAllocator::allocate_zeroed(size_t size, size_t alignment)
+{
+	for (size_t i(0); i < bucketCount; ++i)
+	{
+		if (size <= buckets[i].maxSize)
+			return buckets[i].allocator->allocate_zeroed(size, alignment);
+	}
+	return nullptr;
+}
+
+void BucketizerAllocator::release(void* ptr)
+{
+	SHU_ASSERT(bucketCount > 0);
+
+	//the largest bucket doesnt have to track ownership - it gets anything unclaimed
+	for (size_t i(0); i < bucketCount - 1; ++i)
+	{
+		if (buckets[i].allocator->owns(ptr))
+		{
+			buckets[i].allocator->release(ptr);
+			return;
+		}
+	}
+	buckets[bucketCount - 1].allocator->release(ptr);
+}
+
+void BucketizerAllocator::release_sized(void* ptr, size_t size, size_t alignment)
+{
+	//same bucket it was allocated from
+	for (size_t i(0); i < bucketCount; ++i)
+	{
+		if (size <= buckets[i].maxSize)
+		{
+			buckets[i].allocator->release_sized(ptr, size, alignment);
+			return;
+		}
+	}
+	SHU_ASSERT(false);
+}
+
+bool BucketizerAllocator::try_expand(void* ptr, size_t newSize)
+{
+	//has to stay in the bucket newSize would be allocated from
+	for (size_t i(0); i < bucketCount; ++i)
+	{
+		if (newSize <= buckets[i].maxSize)
+			return buckets[i].allocator->owns(ptr) && buckets[i].allocator->try_expand(ptr, newSize);
+	}
+	return false;
+}
+
+void BucketizerAllocator::handle_signals(GameEventType sig)
+{
+	for (size_t i(0); i < bucketCount; ++i)
+		buckets[i].allocator->handle_signals(sig);
+}
+
+bool BucketizerAllocator::owns(const void* ptr)
+{
+	for (size_t i(0); i < bucketCount; ++i)
+	{
+		if (buckets[i].allocator->owns(ptr))
+			return true;
+	}
+	return false;
+}
+
+//buckets can share an allocator, which only wants visiting once
+void BucketizerAllocator::for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const
+{
+	for (size_t i(0); i < bucketCount; ++i)
+	{
+		if (!is_shared_bucket(i))
+			fn(buckets[i].allocator);
+	}
+}
+
+bool BucketizerAllocator::is_shared_bucket(size_t index) const
+{
+	for (size_t i(0); i < index; ++i)
+	{
+		if (buckets[i].allocator == buckets[index].allocator)
+			return true;
+	}
+	return false;
+}
+
+void* AffixAllocator::allocate(size_t size, size_t alignment)
+{
+	//prefix guard then header in front, rounded up so the user pointer keeps its alignment
+	if (alignment < alignof(affixHeader))
+		alignment = alignof(affixHeader);
+	size_t offset = (prefixGuardSize + sizeof(affixHeader) + alignment - 1) & ~(alignment - 1);
+
+	uint8_t* base = (uint8_t*)parentAllocator->allocate(offset + size + suffixGuardSize, alignment);
+	if (!base)
+		return nullptr;
+
+	uint8_t* ret_p = base + offset;
+
+	//header sits right before the user pointer so release can find it
+	affixHeader* header = (affixHeader*)ret_p - 1;
+	header->size = size;
+	header->offset = (uint32_t)offset;
+	header->magic = kHeaderMagic;
+
+	//guard everything in front of the header, plus the suffix
+	memset(base, kGuardByte, (uint8_t*)header - base);
+	memset(ret_p + size, kGuardByte, suffixGuardSize);
+
+	return ret_p;
+}
+
+bool AffixAllocator::check_guards(const void* ptr) const
+{
+	const uint8_t* p = (const uint8_t*)ptr;
+	const affixHeader* header = (const affixHeader*)p - 1;
+
+	//underrun into the header
+	if (header->magic != kHeaderMagic)
+		return false;
+
+	const uint8_t* base = p - header->offset;
+	for (const uint8_t* g = base; g < (const uint8_t*)header; ++g)
+	{
+		if (*g != kGuardByte)
+			return false;
+	}
+
+	for (size_t i(0); i < suffixGuardSize; ++i)
+	{
+		if (p[header->size + i] != kGuardByte)
+			return false;
+	}
+	return true;
+}
+
+void AffixAllocator::release(void* ptr)
+{
+	SHU_ASSERT(check_guards(ptr));
+
+	const affixHeader* header = (const affixHeader*)ptr - 1;
+	parentAllocator->release((uint8_t*)ptr - header->offset);
+}
+
+void AffixAllocator::release_sized(void* ptr, size_t size, size_t alignment)
+{
+	SHU_ASSERT(check_guards(ptr));
+
+	//caller and header should agree
+	const affixHeader* header = (const affixHeader*)ptr - 1;
+	SHU_ASSERT(header->size == size);
+
+	if (alignment < alignof(affixHeader))
+		alignment = alignof(affixHeader);
+	parentAllocator->release_sized((uint8_t*)ptr - header->offset, header->offset + size + suffixGuardSize, alignment);
+}
+
+bool AffixAllocator::try_expand(void* ptr, size_t newSize)
+{
+	SHU_ASSERT(check_guards(ptr));
+
+	affixHeader* header = (affixHeader*)ptr - 1;
+	if (newSize <= header->size)
+		return true;
+
+	//grow the parent block then move the suffix guard out to the new end
+	if (!parentAllocator->try_expand((uint8_t*)ptr - header->offset, header->offset + newSize + suffixGuardSize))
+		return false;
+
+	header->size = newSize;
+	memset((uint8_t*)ptr + newSize, kGuardByte, suffixGuardSize);
+	return true;
+}
+
+void AffixAllocator::handle_signals(GameEventType sig)
+{
+	parentAllocator->handle_signals(sig);
+}
+
+bool AffixAllocator::owns(const void* ptr)
+{
+	return parentAllocator->owns(ptr);
+}
+
+//usage from the parent includes the guards - they are real bytes in it
+void AffixAllocator::for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const
+{
+	fn(parentAllocator);
+}
+
+#pragma endregion
+
+#pragma region PMR Adapters
+#if PMR_ADAPTERS_ON == 1
+void* AllocatorResource::do_allocate(size_t bytes, size_t alignment)
+{
+	void* ptr = allocator->allocate(bytes, alignment);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void AllocatorResource::do_deallocate(void* ptr, size_t bytes, size_t alignment)
+{
+	allocator->release_sized(ptr, bytes, alignment);
+}
+
+bool AllocatorResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	//two adapters over the same allocator can free each other's memory
+	const AllocatorResource* o = dynamic_cast<const AllocatorResource*>(&other);
+	return o && o->allocator == allocator;
+}
+#endif
+#pragma endregion
+
+#pragma region Fenced GPU Ring
+struct SimulatedGpuTimeline::timelineState {
+	std::mutex lock;
+	std::condition_variable submitted;
+	std::condition_variable retired;
+
+	//fences waiting on the GPU, with when they finish
+	std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> pending;
+	std::chrono::steady_clock::time_point lastDue;
+	uint64_t nextFence = 0;
+	std::atomic<uint64_t> completed{ 0 };
+	bool quit = false;
+
+	uint32_t latencyUs;
+	uint32_t jitterUs;
+	uint32_t rng = 0x9E3779B9u;
+
+	std::thread consumer;
+};
+
+SimulatedGpuTimeline::SimulatedGpuTimeline(uint32_t latencyUs, uint32_t jitterUs)
+{
+	state = new timelineState;
+	state->latencyUs = latencyUs;
+	state->jitterUs = jitterUs;
+
+	//the GPU works through its queue in order, finishing each fence when its time is up
+	timelineState* s = state;
+	state->consumer = std::thread([s] {
+		std::unique_lock<std::mutex> lock(s->lock);
+		while (true)
+		{
+			s->submitted.wait(lock, [s] { return s->quit || !s->pending.empty(); });
+			if (s->pending.empty())
+				return;
+
+			std::pair<uint64_t, std::chrono::steady_clock::time_point> next = s->pending.front();
+			if (!s->quit && std::chrono::steady_clock::now() < next.second)
+			{
+				s->submitted.wait_until(lock, next.second);
+				continue;
+			}
+
+			s->pending.pop_front();
+			s->completed.store(next.first);
+			s->retired.notify_all();
+		}
+	});
+}
+
+uint64_t SimulatedGpuTimeline::signal()
+{
+	std::lock_guard<std::mutex> lock(state->lock);
+
+	//xorshift - only needs to vary, not be good
+	uint32_t jitter = 0;
+	if (state->jitterUs)
+	{
+		state->rng ^= state->rng << 13;
+		state->rng ^= state->rng >> 17;
+		state->rng ^= state->rng << 5;
+		jitter = state->rng % (state->jitterUs + 1);
+	}
+
+	//cant finish before the work in front of it
+	std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now() + std::chrono::microseconds(state->latencyUs + jitter);
+	if (due < state->lastDue)
+		due = state->lastDue;
+	state->lastDue = due;
+
+	uint64_t fence = ++state->nextFence;
+	state->pending.push_back({ fence, due });
+	state->submitted.notify_one();
+	return fence;
+}
+
+uint64_t SimulatedGpuTimeline::get_completed_fence() const
+{
+	return state->completed.load();
+}
+
+uint64_t SimulatedGpuTimeline::get_signalled_fence() const
+{
+	std::lock_guard<std::mutex> lock(state->lock);
+	return state->nextFence;
+}
+
+void SimulatedGpuTimeline::wait_for_fence(uint64_t value)
+{
+	if (state->completed.load() >= value)
+		return;
+
+	std::unique_lock<std::mutex> lock(state->lock);
+	state->retired.wait(lock, [this, value] { return state->completed.load() >= value; });
+}
+
+SimulatedGpuTimeline::~SimulatedGpuTimeline()
+{
+	{
+		std::lock_guard<std::mutex> lock(state->lock);
+		state->quit = true;
+		state->submitted.notify_one();
+	}
+	state->consumer.join();
+	delete state;
+}
+
+void* FencedRingAllocator::find_space(size_t size, size_t alignment, bool& wraps)
+{
+	uint8_t* blockEnd = get_memblock() + get_memorySize();
+
+	//straight on from the head, up to the tail if we are already behind it
+	void* pCur = get_memLoc();
+	size_t sR = (wrapped ? tail : blockEnd) - get_memLoc();
+	void* ret_p = std::align(alignment, size, pCur, sR);
+	wraps = false;
+
+	//round to the start, skipping the end of the block, as long as the oldest frame isnt there
+	if (!ret_p && !wrapped)
+	{
+		pCur = get_memblock();
+		sR = tail - get_memblock();
+		ret_p = std::align(alignment, size, pCur, sR);
+		wraps = (ret_p != nullptr);
+	}
+	return ret_p;
+}
+
+size_t FencedRingAllocator::get_ring_bytes_in_use()
+{
+	if (wrapped)
+		return (get_memblock() + get_memorySize() - tail) + (get_memLoc() - get_memblock());
+	return get_memLoc() - tail;
+}
+
+void FencedRingAllocator::update_space_remaining()
+{
+	uint8_t* limit = wrapped ? tail : get_memblock() + get_memorySize();
+	set_spaceRemaining(limit - get_memLoc());
+}
+
+void* FencedRingAllocator::allocate(size_t size, size_t alignment)
+{
+	//if no memory grabbed - get it
+	if (!get_memblock())
+	{
+		acquire_main_block(get_memorySize());
+		if (!get_memblock())
+			return nullptr;
+		reset_memory_loc();
+		tail = frameStart = get_memblock();
+	}
+
+	bool wraps = false;
+	void* ret_p = find_space(size, alignment, wraps);
+
+	//the GPU may have moved on since the last frame ended
+	if (!ret_p && !frames.empty())
+	{
+		retire_completed();
+		ret_p = find_space(size, alignment, wraps);
+	}
+
+	if (!ret_p)
+	{
+		void* overflow_p = allocate_overflow(size, alignment);
+		if (overflow_p)
+		{
+			frameOverflowBytes += size;
+			overflowBytesInFlight += size;
+			//the ring was full, so everything in flight is what it would have had to hold
+			size_t inFlight = get_memorySize() + overflowBytesInFlight;
+			if (inFlight > inFlightHighWater)
+				inFlightHighWater = inFlight;
+			return overflow_p;
+		}
+
+		//no more blocks - last resort is waiting on the oldest frame the GPU is still reading
+		while (!ret_p && !frames.empty() && frameNumber - frames.front().frameNumber >= minFramesInFlight)
+		{
+			ScopedTraceSlice slice("fenced_ring_stall");
+			++stallCount;
+			timeline->wait_for_fence(frames.front().fence);
+			retire_completed();
+			ret_p = find_space(size, alignment, wraps);
+		}
+		if (!ret_p)
+			return nullptr;
+	}
+
+	//over a hard budget for this tag - refuse without touching the ring
+	if (!charge_tag(get_current_alloc_tag(), size))
+		return nullptr;
+
+	uint8_t* from = wraps ? get_memblock() : get_memLoc();
+	if (wraps)
+		wrapped = frameWraps = true;
+
+	//check if is in gpu space
+	SHU_ASSERT(is_within_mapped_block(ret_p, get_memoryType()))
+
+	//measure alignment offset - skipping the end of the block on a wrap isnt padding, it comes back with the frame
+	ptrdiff_t alignOffset = (uint8_t*)ret_p - from;
+	add_padding(alignOffset);
+
+	push_top_allocation(ret_p, size, alignOffset, get_current_alloc_tag());
+	update_space_remaining();
+
+	size_t inFlight = get_ring_bytes_in_use() + overflowBytesInFlight;
+	if (inFlight > inFlightHighWater)
+		inFlightHighWater = inFlight;
+
+	//log stats
+#if DATALOGGING_ON == 1
+	measure_usage(alignOffset + size);
+#endif
+	profile_allocation(ret_p, size);
+	return ret_p;
+}
+
+void FencedRingAllocator::release_sized(void* ptr, size_t size, size_t /*alignment*/)
+{
+	//refunding the tag and padding here keeps them out of the frame's totals, so retire_front
+	//doesnt give back bytes the frame has already reused
+	if ((uint8_t*)ptr < frameStart || !pop_top_allocation(ptr, size))
+	{
+		release(ptr);
+		return;
+	}
+	update_space_remaining();
+}
+
+void FencedRingAllocator::end_frame()
+{
+	//the fence goes out every frame - others on the timeline (deferred releases) count on it
+	uint64_t fence = timeline->signal();
+
+	//nothing made yet, so nothing for the GPU to read
+	if (!get_memblock())
+	{
+		++frameNumber;
+		return;
+	}
+
+	frameRecord f;
+	f.end = get_memLoc();
+	f.wraps = frameWraps;
+	frameWraps = false;
+	f.fence = fence;
+	f.frameNumber = frameNumber++;
+
+	//what this frame charged, overflow blocks included
+	seal_overflow();
+	f.overflowBlocks = get_overflow_block_count() - queuedOverflowBlocks;
+	queuedOverflowBlocks += f.overflowBlocks;
+	f.overflowBytes = frameOverflowBytes;
+	frameOverflowBytes = 0;
+
+	save_tag_usage(f.tagUsage);
+	for (size_t t(0); t < (size_t)AllocTag::kMaxTags; ++t)
+		f.tagUsage[t] -= frameStartTags[t];
+	save_tag_usage(frameStartTags);
+	f.padding = get_padding_bytes() - frameStartPadding;
+	frameStartPadding = get_padding_bytes();
+
+	frames.push_back(f);
+	frameStart = get_memLoc();
+	//nothing from an ended frame can grow
+	clear_top_allocations();
+
+	retire_completed();
+}
+
+void FencedRingAllocator::retire_front()
+{
+	const frameRecord& f = frames.front();
+
+	//a frame that went round the end comes back in two parts
+	if (f.wraps)
+	{
+		profile_release_range(tail, get_memblock() + get_memorySize() - tail);
+		profile_release_range(get_memblock(), f.end - get_memblock());
+		wrapped = false;
+	}
+	else
+	{
+		profile_release_range(tail, f.end - tail);
+	}
+	tail = f.end;
+
+	for (size_t t(0); t < (size_t)AllocTag::kMaxTags; ++t)
+	{
+		refund_tag((AllocTag)t, f.tagUsage[t]);
+		frameStartTags[t] -= f.tagUsage[t];
+	}
+	remove_padding(f.padding);
+	frameStartPadding -= f.padding;
+
+	recycle_oldest_overflow(f.overflowBlocks);
+	queuedOverflowBlocks -= f.overflowBlocks;
+	overflowBytesInFlight -= f.overflowBytes;
+
+	frames.erase(frames.begin());
+}
+
+void FencedRingAllocator::retire_completed()
+{
+	uint64_t completed = timeline->get_completed_fence();
+	while (!frames.empty() && frames.front().fence <= completed && frameNumber - frames.front().frameNumber >= minFramesInFlight)
+		retire_front();
+
+	//nothing in use at all - back to the start so the next frames dont straddle the end
+	if (frames.empty() && get_memLoc() == tail)
+	{
+		reset_memory_loc();
+		tail = frameStart = get_memblock();
+		wrapped = frameWraps = false;
+	}
+	update_space_remaining();
+}
+
+void FencedRingAllocator::handle_signals(GameEventType sig)
+{
+	switch (sig)
+	{
+	case GameEventType::kEventNextFrame:
+		end_frame();
+		break;
+	default:
+		break;
+	}
+}
+
+FencedRingAllocator::~FencedRingAllocator()
+{
+	if (!frames.empty())
+		timeline->wait_for_fence(frames.back().fence);
+}
+#pragma endregion
+
+#pragma region Deferred Release Allocator
+void* DeferredReleaseAllocator::allocate(size_t size, size_t alignment)
+{
+	return parentAllocator->allocate(size, alignment);
+}
+
+void* DeferredReleaseAllocator::allocate_zeroed(size_t size, size_t alignment)
+{
+	return parentAllocator->allocate_zeroed(size, alignment);
+}
+
+void DeferredReleaseAllocator::release(void* ptr)
+{
+	release_sized(ptr, 0, 0);
+}
+
+void DeferredReleaseAllocator::release_sized(void* ptr, size_t size, size_t alignment)
+{
+	if (!ptr)
+		return;
+
+	//everything submitted so far is covered by the next fence signalled
+	uint64_t fence = timeline ? timeline->get_signalled_fence() + 1 : 0;
+	pending.push_back({ ptr, size, alignment, frameNumber, fence });
+	pendingBytes += size;
+}
+
+bool DeferredReleaseAllocator::try_expand(void* ptr, size_t newSize)
+{
+	return parentAllocator->try_expand(ptr, newSize);
+}
+
+void DeferredReleaseAllocator::release_front(size_t count)
+{
+	if (!count)
+		return;
+
+	ScopedTraceSlice slice("deferred_release_batch");
+
+	//highest address first - a stack parent pops each one off its top in turn
+	batch.assign(pending.begin(), pending.begin() + count);
+	pending.erase(pending.begin(), pending.begin() + count);
+	std::sort(batch.begin(), batch.end(), [](const pendingRelease& a, const pendingRelease& b) { return (uintptr_t)a.ptr > (uintptr_t)b.ptr; });
+
+	for (const pendingRelease& r : batch)
+	{
+		if (r.size)
+			parentAllocator->release_sized(r.ptr, r.size, r.alignment);
+		else
+			parentAllocator->release(r.ptr);
+		pendingBytes -= r.size;
+	}
+	releasedCount += count;
+	batch.clear();
+}
+
+void DeferredReleaseAllocator::release_ready()
+{
+	uint64_t completed = timeline ? timeline->get_completed_fence() : 0;
+
+	size_t count = 0;
+	while (count < pending.size() && frameNumber - pending[count].frameNumber >= minFramesDeferred && (!timeline || pending[count].fence <= completed))
+		++count;
+	release_front(count);
+}
+
+void DeferredReleaseAllocator::release_all()
+{
+	if (pending.empty())
+		return;
+
+	//work not submitted yet cant be reading anything - and waiting on its fence would never return
+	if (timeline)
+	{
+		uint64_t fence = timeline->get_signalled_fence();
+		timeline->wait_for_fence(pending.back().fence < fence ? pending.back().fence : fence);
+	}
+	release_front(pending.size());
+}
+
+void DeferredReleaseAllocator::handle_signals(GameEventType sig)
+{
+	switch (sig)
+	{
+	case GameEventType::kEventLevelUnload:
+		//the parent is about to take the lot back - nothing can be left pointing into it
+		release_all();
+		break;
+	case GameEventType::kEventNextFrame:
+		++frameNumber;
+		release_ready();
+		break;
+	default:
+		break;
+	}
+	parentAllocator->handle_signals(sig);
+}
+
+bool DeferredReleaseAllocator::owns(const void* ptr)
+{
+	return parentAllocator->owns(ptr);
+}
+
+//queued releases are still the parent's until they are handed back
+void DeferredReleaseAllocator::for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const
+{
+	fn(parentAllocator);
+}
+
+//the queue goes with the parent's memory - a restore brings back the releases that were waiting then
+void DeferredReleaseAllocator::save_snapshot_state(std::vector<uint8_t>& state) const
+{
+	IMemoryAllocatorX::save_snapshot_state(state);
+	put_state(state, frameNumber);
+	put_state(state, pendingBytes);
+	put_state(state, pending.size());
+	for (const pendingRelease& r : pending)
+		put_state(state, r);
+}
+
+bool DeferredReleaseAllocator::restore_snapshot_state(const uint8_t*& state, bool checkOnly)
+{
+	if (!IMemoryAllocatorX::restore_snapshot_state(state, checkOnly))
+		return false;
+
+	uint64_t frame = get_state<uint64_t>(state);
+	size_t bytes = get_state<size_t>(state);
+	size_t count = get_state<size_t>(state);
+	if (checkOnly)
+	{
+		state += count * sizeof(pendingRelease);
+		return true;
+	}
+
+	frameNumber = frame;
+	pendingBytes = bytes;
+	pending.clear();
+	for (size_t i(0); i < count; ++i)
+		pending.push_back(get_state<pendingRelease>(state));
+	return true;
+}
+
+DeferredReleaseAllocator::~DeferredReleaseAllocator()
+{
+	release_all();
+}
+#pragma endregion
+
+#pragma region Level Streaming
+//positional reads - safe to issue from several threads on one handle, and they run side by side
+#if defined(_WIN32)
+typedef HANDLE StreamFile;
+static const StreamFile kInvalidStreamFile = INVALID_HANDLE_VALUE;
+
+static StreamFile stream_open(const char* path)
+{
+	//without overlapped the handle does one read at a time, whichever worker asks
+	return CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OVERLAPPED, nullptr);
+}
+
+static size_t stream_read_at(StreamFile file, void* dest, size_t size, uint64_t offset)
+{
+	OVERLAPPED ov = {};
+	ov.Offset = (DWORD)offset;
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+	//an event per read - the handle itself is signalled by whichever read finishes first
+	ov.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+	if (!ov.hEvent)
+		return 0;
+
+	DWORD read = 0;
+	if (!ReadFile(file, dest, (DWORD)size, nullptr, &ov) && GetLastError() != ERROR_IO_PENDING)
+		read = 0;
+	else if (!GetOverlappedResult(file, &ov, &read, TRUE))
+		read = 0;
+	CloseHandle(ov.hEvent);
+	return read;
+}
+
+static void stream_close(StreamFile file)
+{
+	CloseHandle(file);
+}
+#else
+typedef int StreamFile;
+static const StreamFile kInvalidStreamFile = -1;
+
+static StreamFile stream_open(const char* path)
+{
+	return open(path, O_RDONLY);
+}
+
+static size_t stream_read_at(StreamFile file, void* dest, size_t size, uint64_t offset)
+{
+	size_t total(0);
+	while (total < size)
+	{
+		ssize_t n = pread(file, (uint8_t*)dest + total, size - total, (off_t)(offset + total));
+		if (n <= 0)
+			break;
+		total += (size_t)n;
+	}
+	return total;
+}
+
+static void stream_close(StreamFile file)
+{
+	close(file);
+}
+#endif
+
+struct LevelStreamer::streamState {
+	struct readChunk {
+		StreamFile file;
+		uint64_t offset;
+		size_t size;
+		uint8_t* dest;
+	};
+
+	std::vector<std::thread> workers;
+	std::deque<readChunk> queue;
+	std::mutex queueMutex;
+	std::condition_variable workReady;
+	std::condition_variable allDone;
+	size_t pendingChunks = 0;
+	bool stopping = false;
+	bool failed = false;
+
+	std::unordered_map<std::string, StreamFile> openFiles;
+	std::atomic<size_t> bytesRead;
+
+	streamState() : bytesRead(0) {};
+};
+
+LevelStreamer::LevelStreamer(IMemoryAllocatorX* arena, uint32_t workers) : arenaAllocator(arena), workerCount(workers ? workers : 1)
+{
+	state = new streamState;
+}
+
+LevelStreamer::~LevelStreamer()
+{
+	wait_complete();
+	{
+		std::lock_guard<std::mutex> lock(state->queueMutex);
+		state->stopping = true;
+	}
+	state->workReady.notify_all();
+	for (std::thread& t : state->workers)
+		t.join();
+	delete state;
+}
+
+void LevelStreamer::start_workers()
+{
+	//only spun up once there is something to load
+	if (!state->workers.empty())
+		return;
+	for (uint32_t i(0); i < workerCount; ++i)
+		state->workers.emplace_back(&LevelStreamer::worker_loop, this);
+}
+
+void LevelStreamer::worker_loop()
+{
+	for (;;)
+	{
+		streamState::readChunk chunk;
+		{
+			std::unique_lock<std::mutex> lock(state->queueMutex);
+			state->workReady.wait(lock, [this] { return state->stopping || !state->queue.empty(); });
+			if (state->queue.empty())
+				return;
+			chunk = state->queue.front();
+			state->queue.pop_front();
+		}
+
+		//straight into the arena
+		size_t read = stream_read_at(chunk.file, chunk.dest, chunk.size, chunk.offset);
+		state->bytesRead += read;
+
+		std::lock_guard<std::mutex> lock(state->queueMutex);
+		if (read != chunk.size)
+			state->failed = true;
+		if (--state->pendingChunks == 0)
+			state->allDone.notify_all();
+	}
+}
+
+bool LevelStreamer::begin_load(manifestEntry* entries, size_t count)
+{
+	//one load at a time
+	wait_complete();
+	ScopedTraceSlice slice("level_stream_begin");
+
+	//reserve everything up front so the arena layout doesnt depend on read order
+	for (size_t i(0); i < count; ++i)
+	{
+		entries[i].dest = arenaAllocator->allocate(entries[i].size, entries[i].alignment);
+		if (!entries[i].dest)
+			return false;
+	}
+
+	for (size_t i(0); i < count; ++i)
+	{
+		if (state->openFiles.count(entries[i].path))
+			continue;
+		StreamFile file = stream_open(entries[i].path);
+		if (file == kInvalidStreamFile)
+		{
+			wait_complete();
+			return false;
+		}
+		state->openFiles[entries[i].path] = file;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(state->queueMutex);
+		state->failed = false;
+		for (size_t i(0); i < count; ++i)
+		{
+			StreamFile file = state->openFiles[entries[i].path];
+			for (size_t done(0); done < entries[i].size; done += kChunkSize)
+			{
+				size_t size = entries[i].size - done < kChunkSize ? entries[i].size - done : kChunkSize;
+				state->queue.push_back({ file, entries[i].fileOffset + done, size, (uint8_t*)entries[i].dest + done });
+				++state->pendingChunks;
+			}
+		}
+	}
+
+	start_workers();
+	state->workReady.notify_all();
+	return true;
+}
+
+bool LevelStreamer::is_complete() const
+{
+	std::lock_guard<std::mutex> lock(state->queueMutex);
+	return state->pendingChunks == 0;
+}
+
+bool LevelStreamer::wait_complete()
+{
+	bool ok;
+	{
+		std::unique_lock<std::mutex> lock(state->queueMutex);
+		if (state->pendingChunks)
+		{
+			ScopedTraceSlice slice("level_stream_wait");
+			state->allDone.wait(lock, [this] { return state->pendingChunks == 0; });
+		}
+		ok = !state->failed;
+	}
+
+	//nothing in flight - files can go
+	for (auto& f : state->openFiles)
+		stream_close(f.second);
+	state->openFiles.clear();
+	return ok;
+}
+
+size_t LevelStreamer::get_bytes_read() const
+{
+	return state->bytesRead;
+}
+#pragma endregion
+
+#pragma region Arena Snapshots
+//bumped by every clear of the soft dirty bits, whoever does it
+static std::atomic<uint64_t> g_dirtyClearEpoch(0);
+
+struct dirtyTracker {
+	bool on = false;
+	int clearFd = -1;
+	int pagemapFd = -1;
+};
+
+#if defined(__linux__)
+//soft dirty bit of a pagemap entry, plus present / swapped
+constexpr uint64_t kPagemapSoftDirty = 1ull << 55;
+constexpr uint64_t kPagemapInMemory = (1ull << 63) | (1ull << 62);
+
+static bool read_pagemap(int fd, const uint8_t* base, size_t size, std::vector<uint64_t>& entries)
+{
+	size_t pageSize = get_page_size();
+	uintptr_t firstPage = (uintptr_t)base / pageSize;
+	uintptr_t lastPage = ((uintptr_t)base + size + pageSize - 1) / pageSize;
+	entries.resize(lastPage - firstPage);
+	size_t bytes = entries.size() * sizeof(uint64_t);
+	return pread(fd, entries.data(), bytes, (off_t)(firstPage * sizeof(uint64_t))) == (ssize_t)bytes;
+}
+#endif
+
+//soft dirty tracking needs clear_refs, a readable pagemap and a kernel built with it,
+//so check a page written after a clear really does show up
+static dirtyTracker probe_dirty_tracking()
+{
+	dirtyTracker tracker;
+#if defined(__linux__)
+	tracker.clearFd = open("/proc/self/clear_refs", O_WRONLY);
+	tracker.pagemapFd = open("/proc/self/pagemap", O_RDONLY);
+	size_t pageSize = get_page_size();
+	uint8_t* page = (uint8_t*)mmap(nullptr, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (tracker.clearFd >= 0 && tracker.pagemapFd >= 0 && page != MAP_FAILED)
+	{
+		std::vector<uint64_t> entries;
+		page[0] = 1;
+		bool cleared = write(tracker.clearFd, "4", 1) == 1 && read_pagemap(tracker.pagemapFd, page, 1, entries) && !(entries[0] & kPagemapSoftDirty);
+		*(volatile uint8_t*)page = 2;
+		tracker.on = cleared && read_pagemap(tracker.pagemapFd, page, 1, entries) && (entries[0] & kPagemapSoftDirty);
+		++g_dirtyClearEpoch;
+	}
+	if (page != MAP_FAILED)
+		munmap(page, pageSize);
+	if (!tracker.on)
+	{
+		if (tracker.clearFd >= 0)
+			close(tracker.clearFd);
+		if (tracker.pagemapFd >= 0)
+			close(tracker.pagemapFd);
+		tracker.clearFd = tracker.pagemapFd = -1;
+	}
+#endif
+	return tracker;
+}
+
+static const dirtyTracker& get_dirty_tracker()
+{
+	static dirtyTracker tracker = probe_dirty_tracking();
+	return tracker;
+}
+
+//captures are write once, read maybe never, so keep them out of the cache
+static void stream_copy(uint8_t* dst, const uint8_t* src, size_t size)
+{
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#if defined(__AVX2__)
+	constexpr size_t kStreamWidth = 32;
+#else
+	constexpr size_t kStreamWidth = 16;
+#endif
+	size_t head = (kStreamWidth - ((uintptr_t)dst & (kStreamWidth - 1))) & (kStreamWidth - 1);
+	if (head > size)
+		head = size;
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+
+	size_t body = size & ~(kStreamWidth - 1);
+	for (size_t i(0); i < body; i += kStreamWidth)
+	{
+#if defined(__AVX2__)
+		_mm256_stream_si256((__m256i*)(dst + i), _mm256_loadu_si256((const __m256i*)(src + i)));
+#else
+		_mm_stream_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+#endif
+	}
+	memcpy(dst + body, src + body, size - body);
+#else
+	memcpy(dst, src, size);
+#endif
+}
+
+//copies size bytes, or only the pages of live written since the last clear; returns bytes copied
+static size_t copy_pages(uint8_t* dst, const uint8_t* src, const uint8_t* live, size_t size, bool dirtyOnly, bool stream)
+{
+	if (!size)
+		return 0;
+
+#if defined(__linux__)
+	std::vector<uint64_t> entries;
+	if (dirtyOnly && read_pagemap(get_dirty_tracker().pagemapFd, live, size, entries))
+	{
+		size_t pageSize = get_page_size();
+		size_t copied = 0;
+		size_t offset = 0;
+		size_t page = 0;
+		while (offset < size)
+		{
+			//runs of pages that are dirty, or not in memory at all and so cant be vouched for
+			size_t pageEnd = ((uintptr_t)live + offset) / pageSize * pageSize + pageSize - (uintptr_t)live;
+			size_t runStart = offset;
+			while (offset < size && ((entries[page] & kPagemapSoftDirty) || !(entries[page] & kPagemapInMemory)))
+			{
+				offset = pageEnd < size ? pageEnd : size;
+				pageEnd += pageSize;
+				++page;
+			}
+			if (offset > runStart)
+			{
+				if (stream)
+					stream_copy(dst + runStart, src + runStart, offset - runStart);
+				else
+					memcpy(dst + runStart, src + runStart, offset - runStart);
+				copied += offset - runStart;
+				continue;
+			}
+			offset = pageEnd < size ? pageEnd : size;
+			++page;
+		}
+		return copied;
+	}
+#else
+	(void)live;
+	(void)dirtyOnly;
+#endif
+	if (stream)
+		stream_copy(dst, src, size);
+	else
+		memcpy(dst, src, size);
+	return size;
+}
+
+ArenaSnapshot::~ArenaSnapshot()
+{
+	for (regionCopy& rc : copies)
+		delete[] rc.copy;
+}
+
+bool ArenaSnapshot::is_dirty_tracking_on() const
+{
+	return get_dirty_tracker().on;
+}
+
+void ArenaSnapshot::clear_dirty_pages()
+{
+#if defined(__linux__)
+	const dirtyTracker& tracker = get_dirty_tracker();
+	if (tracker.on && write(tracker.clearFd, "4", 1) == 1)
+	{
+		dirtyEpoch = ++g_dirtyClearEpoch;
+		return;
+	}
+#endif
+	dirtyEpoch = 0;
+}
+
+bool ArenaSnapshot::capture()
+{
+	ScopedTraceSlice slice("arena_snapshot_capture");
+	for (const std::function<void()>& hook : quiesceHooks)
+		hook();
+
+	std::vector<IMemoryAllocatorX::snapshotRegion> regions;
+	for (IMemoryAllocatorX* allocator : allocators)
+	{
+		if (!allocator->get_snapshot_regions(regions))
+			return false;
+	}
+
+	states.resize(allocators.size());
+	for (size_t i(0); i < allocators.size(); ++i)
+	{
+		states[i].clear();
+		allocators[i]->save_snapshot_state(states[i]);
+	}
+
+	bool dirtyValid = captured && dirtyEpoch && dirtyEpoch == g_dirtyClearEpoch.load();
+	while (copies.size() > regions.size())
+	{
+		delete[] copies.back().copy;
+		copies.pop_back();
+	}
+
+	lastCopyBytes = 0;
+	for (size_t i(0); i < regions.size(); ++i)
+	{
+		if (i == copies.size())
+			copies.push_back({ nullptr, 0, nullptr, 0 });
+		regionCopy& rc = copies[i];
+		const IMemoryAllocatorX::snapshotRegion& r = regions[i];
+
+		bool sameRegion = dirtyValid && rc.base == r.base;
+		if (r.size > rc.capacity)
+		{
+			delete[] rc.copy;
+			rc.copy = new uint8_t[r.size];
+			rc.capacity = r.size;
+			sameRegion = false;
+		}
+
+		//what we already hold only needs the written pages, anything past it goes over whole
+		size_t known = sameRegion ? (rc.size < r.size ? rc.size : r.size) : 0;
+		lastCopyBytes += copy_pages(rc.copy, r.base, r.base, known, true, true);
+		stream_copy(rc.copy + known, r.base + known, r.size - known);
+		lastCopyBytes += r.size - known;
+		rc.base = r.base;
+		rc.size = r.size;
+	}
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+	_mm_sfence();
+#endif
+
+	clear_dirty_pages();
+	captured = true;
+	return true;
+}
+
+bool ArenaSnapshot::restore()
+{
+	if (!captured)
+		return false;
+
+	ScopedTraceSlice slice("arena_snapshot_restore");
+	for (const std::function<void()>& hook : quiesceHooks)
+		hook();
+
+	//the same blocks have to still be there, in the same order, before anything is written
+	std::vector<IMemoryAllocatorX::snapshotRegion> regions;
+	for (IMemoryAllocatorX* allocator : allocators)
+	{
+		if (!allocator->get_snapshot_regions(regions))
+			return false;
+	}
+	if (regions.size() != copies.size())
+		return false;
+	for (size_t i(0); i < regions.size(); ++i)
+	{
+		if (regions[i].base != copies[i].base)
+			return false;
+	}
+	for (size_t i(0); i < allocators.size(); ++i)
+	{
+		const uint8_t* state = states[i].data();
+		if (!allocators[i]->restore_snapshot_state(state, true))
+			return false;
+	}
+
+	bool dirtyValid = dirtyEpoch && dirtyEpoch == g_dirtyClearEpoch.load();
+	lastCopyBytes = 0;
+	for (regionCopy& rc : copies)
+		lastCopyBytes += copy_pages(rc.base, rc.copy, rc.base, rc.size, dirtyValid, false);
+
+	for (size_t i(0); i < allocators.size(); ++i)
+	{
+		const uint8_t* state = states[i].data();
+		allocators[i]->restore_snapshot_state(state, false);
+	}
+
+	clear_dirty_pages();
+	return true;
+}
+#pragma endregion
+
+#pragma region Lifetime Events
+uint32_t LifetimeEventRegistry::subscribe(GameEventType evt, int priority, Callback callback)
+{
+	size_t index = (size_t)evt;
+	if (index >= events.size())
+		events.resize(index + 1);
+
+	//after everything at the same priority, so ties keep subscription order
+	std::vector<listener>& list = events[index];
+	std::vector<listener>::iterator at = std::upper_bound(list.begin(), list.end(), priority,
+		[](int p, const listener& l) { return p < l.priority; });
+	uint32_t id = nextId++;
+	list.insert(at, { id, priority, std::move(callback) });
+	return id;
+}
 
-void * ObjectPoolManager::allocate(size_t size, size_t alignment)
+uint32_t LifetimeEventRegistry::subscribe_allocator(GameEventType evt, int priority, IMemoryAllocatorX* allocator)
 {
-		//if no memory grabbed - get it
-		if (!get_memblock())
+	return subscribe(evt, priority, [allocator](GameEventType e) { allocator->handle_signals(e); });
+}
+
+void LifetimeEventRegistry::unsubscribe(uint32_t id)
+{
+	for (std::vector<listener>& list : events)
+	{
+		for (size_t i(0); i < list.size(); ++i)
 		{
-			//TEST MEMORY SIZE
-			int blocksize = get_memorySize();
-			set_spaceRemaining(blocksize);
-			set_memblock((uint8_t*)allocate_system_block(blocksize, get_memoryType()));	
-			reset_memory_loc();
-			
-			//record where the block ends
-			endOfBlock = get_memLoc() + blocksize;
-
-			//init the pool - splat it across the requested data
-			allocationPool = new(get_memLoc()) dataPack[MaxAllocations - 1];
-			
-			// The first one is available.
-			firstAvailable = &allocationPool[0];
-
-			// Each pack of data points to the next.
-			for (int i(0); i < MaxAllocations - 1; i++)
+			if (list[i].id == id)
 			{
-				allocationPool[i].setNext(&allocationPool[i + 1]);
-				allocationPool[i].live = 0;
+				list.erase(list.begin() + i);
+				return;
 			}
+		}
+	}
+}
+
+void LifetimeEventRegistry::dispatch(GameEventType evt) const
+{
+	size_t index = (size_t)evt;
+	if (index >= events.size())
+		return;
+
+	for (const listener& l : events[index])
+		l.callback(evt);
+}
+
+size_t LifetimeEventRegistry::get_listener_count(GameEventType evt) const
+{
+	size_t index = (size_t)evt;
+	return index < events.size() ? events[index].size() : 0;
+}
+#pragma endregion
+
+#pragma region Sizing Profile
+size_t IMemoryAllocatorX::get_sizing_high_water() const
+{
+	//a composite has to fit its busiest child (every node instance of a NumaLocal is the same size)
+	size_t highWater(0);
+	for_each_child([&](IMemoryAllocatorX* child) {
+		if (child->get_sizing_high_water() > highWater)
+			highWater = child->get_sizing_high_water();
+	});
+	return highWater;
+}
+
+bool SizingProfile::load(const char* filename)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+		return false;
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		char name[128];
+		unsigned long long highWater;
+		if (sscanf(line.c_str(), "%127s %llu", name, &highWater) == 2)
+			record(name, (size_t)highWater);
+	}
+	return true;
+}
+
+bool SizingProfile::save(const char* filename) const
+{
+	std::ofstream file(filename, std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	file << "# allocator high water marks - bytes, slots for pools\n";
+	for (const entry& e : entries)
+		file << e.name << " " << e.highWater << "\n";
+	return file.good();
+}
 
-			// The last one terminates the list.
-			allocationPool[MaxAllocations - 1].setNext(nullptr);
+void SizingProfile::record(const char* name, size_t highWater)
+{
+	for (entry& e : entries)
+	{
+		if (e.name == name)
+		{
+			e.highWater = highWater;
+			return;
 		}
+	}
+	entries.push_back({ name, highWater });
+}
 
-		//find our first free element
-		uint8_t* ret_p = (uint8_t*)add_data();
+size_t SizingProfile::get_high_water(const char* name) const
+{
+	for (const entry& e : entries)
+	{
+		if (e.name == name)
+			return e.highWater;
+	}
+	return 0;
+}
 
-		//check we are not out of range
-		SHU_ASSERT((uint8_t*)ret_p <= (uint8_t*)&allocationPool[MaxAllocations-1]);
+size_t SizingProfile::get_size(const char* name, size_t fallback, size_t granule) const
+{
+	//not profiled, or never used in the recorded run - nothing to go on
+	size_t highWater = get_high_water(name);
+	if (highWater == 0)
+		return fallback;
 
-		//return the address of first pool location + offset for pointer to next
-		ret_p += kMemOffset;
+	size_t size = highWater + (size_t)std::ceil(highWater * (double)margin);
+	return (size + granule - 1) / granule * granule;
+}
+#pragma endregion
 
-		//check if is in chosen space and in range
-		SHU_ASSERT(is_within_mapped_block(ret_p, get_memoryType()));
+#pragma region Upload Staging
+struct UploadStager::stagingState {
+	struct copyRequest {
+		uint8_t* dst;
+		const uint8_t* src;
+		size_t size;
+	};
+
+	//filled during the frame
+	std::vector<copyRequest> queued;
+	//being copied - only touched by whoever runs the batch until it is done
+	std::vector<copyRequest> batch;
+
+	std::mutex lock;
+	std::condition_variable batchReady;
+	std::condition_variable batchDone;
+	bool batchPending = false;
+	bool stopping = false;
+	std::thread worker;
+
+	std::atomic<uint64_t> bytesUploaded{ 0 };
+	std::atomic<size_t> requestCount{ 0 };
+	std::atomic<size_t> copyCount{ 0 };
+	std::atomic<uint64_t> copyNanoseconds{ 0 };
+};
+
+//sorted by destination, runs back to back at both ends become one copy
+void UploadStager::run_batch()
+{
+	ScopedTraceSlice slice("upload_batch");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<stagingState::copyRequest>& batch = state->batch;
+	//stable, so overlapping copies still land in the order they were queued
+	std::stable_sort(batch.begin(), batch.end(), [](const stagingState::copyRequest& a, const stagingState::copyRequest& b) {
+		return (uintptr_t)a.dst < (uintptr_t)b.dst; });
+
+	uint64_t bytes = 0;
+	size_t copies = 0;
+	size_t i = 0;
+	while (i < batch.size())
+	{
+		uint8_t* dst = batch[i].dst;
+		const uint8_t* src = batch[i].src;
+		size_t size = batch[i].size;
+		for (++i; i < batch.size() && batch[i].dst == dst + size && batch[i].src == src + size; ++i)
+			size += batch[i].size;
+
+		stream_copy(dst, src, size);
+		bytes += size;
+		++copies;
+	}
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+	_mm_sfence();
+#endif
 
-		return ret_p;
+	state->bytesUploaded += bytes;
+	state->requestCount += batch.size();
+	state->copyCount += copies;
+	state->copyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	trace_counter("UploadBytes", (size_t)bytes);
+	batch.clear();
 }
 
-void ObjectPoolManager::release(void * ptr)
+UploadStager::UploadStager(bool worker) : useWorker(worker)
 {
-	//free whatever was stored in the data
-	dataPack* dpp = (dataPack*)((uint8_t*)ptr - kMemOffset);
-	dpp->live = 0;
+	state = new stagingState;
+}
 
-	dpp->setNext(firstAvailable);
-	firstAvailable = dpp;
+UploadStager::~UploadStager()
+{
+	flush();
+	wait_complete();
+	if (state->worker.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(state->lock);
+			state->stopping = true;
+		}
+		state->batchReady.notify_one();
+		state->worker.join();
+	}
+	delete state;
 }
 
-ObjectPoolManager::~ObjectPoolManager()
+void UploadStager::queue_copy(void* dst, const void* src, size_t size)
 {
-#if DATALOGGING_ON == 1
-	size_t usedNodes(0);
-	for (int i(0); i < MaxAllocations - 1; i++)
+	if (!size)
+		return;
+	state->queued.push_back({ (uint8_t*)dst, (const uint8_t*)src, size });
+}
+
+void* UploadStager::queue_upload(IMemoryAllocatorX* gpuAllocator, const void* src, size_t size, size_t alignment)
+{
+	void* dst = gpuAllocator->allocate(size, alignment);
+	if (dst)
+		queue_copy(dst, src, size);
+	return dst;
+}
+
+void UploadStager::flush()
+{
+	wait_complete();
+	if (state->queued.empty())
+		return;
+
+	//the worker only looks at batch while batchPending is set, so swapping here is safe
+	state->batch.swap(state->queued);
+	if (!useWorker)
 	{
-		if (allocationPool[i].used)
-			++usedNodes;
+		run_batch();
+		return;
 	}
 
-	output_all_data("Object Pool Allocator");
+	//only spun up once there is something to copy
+	if (!state->worker.joinable())
+		state->worker = std::thread(&UploadStager::worker_loop, this);
+	{
+		std::lock_guard<std::mutex> lock(state->lock);
+		state->batchPending = true;
+	}
+	state->batchReady.notify_one();
+}
 
-	std::ofstream datalog("datalog.csv", std::fstream::app);
-	datalog << "used nodes:," << usedNodes << ",\n"
-	<< "max nodes:," << MaxAllocations << ",\n\n";
-	datalog.close();
+void UploadStager::wait_complete()
+{
+	std::unique_lock<std::mutex> lock(state->lock);
+	state->batchDone.wait(lock, [this] { return !state->batchPending; });
+}
+
+void UploadStager::worker_loop()
+{
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(state->lock);
+			state->batchReady.wait(lock, [this] { return state->stopping || state->batchPending; });
+			if (!state->batchPending)
+				return;
+		}
+
+		run_batch();
+
+		{
+			std::lock_guard<std::mutex> lock(state->lock);
+			state->batchPending = false;
+		}
+		state->batchDone.notify_all();
+	}
+}
+
+size_t UploadStager::get_queued_count() const
+{
+	return state->queued.size();
+}
+
+uint64_t UploadStager::get_bytes_uploaded() const
+{
+	return state->bytesUploaded.load();
+}
+
+size_t UploadStager::get_request_count() const
+{
+	return state->requestCount.load();
+}
+
+size_t UploadStager::get_copy_count() const
+{
+	return state->copyCount.load();
+}
+
+double UploadStager::get_upload_bandwidth() const
+{
+	uint64_t ns = state->copyNanoseconds.load();
+	return ns ? (double)state->bytesUploaded.load() * 1e9 / (double)ns : 0.0;
+}
+#pragma endregion
+
+#pragma region Guarded Sampling Allocator
+//every guarded allocator the fault handler should ask
+constexpr size_t kMaxGuardedAllocators = 8;
+static GuardedSamplingAllocator* g_guardedAllocators[kMaxGuardedAllocators] = {};
+
+static void protect_pages(void* p, size_t size, bool readWrite)
+{
+#if defined(_WIN32)
+	DWORD oldProtect;
+	VirtualProtect(p, size, readWrite ? PAGE_READWRITE : PAGE_NOACCESS, &oldProtect);
+#else
+	mprotect(p, size, readWrite ? (PROT_READ | PROT_WRITE) : PROT_NONE);
+#endif
+}
+
+//the fault report is built in a fixed buffer and written straight to stderr - no stdio or heap,
+//which arent safe inside a signal handler
+struct faultReport {
+	char text[256];
+	size_t length = 0;
+
+	void add(const char* s)
+	{
+		while (*s && length < sizeof(text))
+			text[length++] = *s++;
+	}
+	void add_number(uint64_t value, uint32_t base)
+	{
+		char digits[24];
+		size_t count(0);
+		do
+		{
+			digits[count++] = "0123456789abcdef"[value % base];
+			value /= base;
+		} while (value);
+		if (base == 16)
+			add("0x");
+		while (count && length < sizeof(text))
+			text[length++] = digits[--count];
+	}
+	void flush()
+	{
+#if defined(_WIN32)
+		fwrite(text, 1, length, stderr);
+#else
+		ssize_t written = write(2, text, length);
+		(void)written;
+#endif
+		length = 0;
+	}
+};
+
+static void print_stack(const char* title, void* const* frames, uint32_t count)
+{
+	faultReport report;
+	report.add("  ");
+	report.add(title);
+	report.add(":\n");
+	report.flush();
+#if defined(__linux__)
+	backtrace_symbols_fd(frames, (int)count, 2);
+#else
+	for (uint32_t i(0); i < count; ++i)
+	{
+		report.add("    #");
+		report.add_number(i, 10);
+		report.add(" ");
+		report.add_number(reinterpret_cast<uintptr_t>(frames[i]), 16);
+		report.add("\n");
+		report.flush();
+	}
+#endif
+}
+
+static bool report_guarded_fault(const void* addr)
+{
+	for (size_t i(0); i < kMaxGuardedAllocators; ++i)
+	{
+		if (g_guardedAllocators[i] && g_guardedAllocators[i]->report_fault(addr))
+			return true;
+	}
+	return false;
+}
+
+#if defined(_WIN32)
+static LONG CALLBACK guarded_fault_handler(PEXCEPTION_POINTERS info)
+{
+	if (info->ExceptionRecord->ExceptionCode == EXCEPTION_ACCESS_VIOLATION)
+		report_guarded_fault((const void*)info->ExceptionRecord->ExceptionInformation[1]);
+	//always let it carry on crashing as it would have
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+#elif defined(__linux__)
+static struct sigaction g_previousSegvAction;
+
+static void guarded_fault_handler(int, siginfo_t* info, void*)
+{
+	report_guarded_fault(info->si_addr);
+	//put back whoever was there before, returning re-runs the faulting access
+	sigaction(SIGSEGV, &g_previousSegvAction, nullptr);
+}
 #endif
 
-	//delete[] allocationPool;
-	release_system_block(get_memblock());
+static void install_guarded_fault_handler()
+{
+	static bool installed = false;
+	if (installed)
+		return;
+	installed = true;
+
+#if defined(_WIN32)
+	AddVectoredExceptionHandler(1, guarded_fault_handler);
+#elif defined(__linux__)
+	//the first backtrace loads the unwinder, which allocates - get that over with outside the handler
+	void* frames[1];
+	backtrace(frames, 1);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = guarded_fault_handler;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, &g_previousSegvAction);
+#endif
 }
 
-ObjectPoolManager::dataPack* ObjectPoolManager::add_data()
+uint32_t GuardedSamplingAllocator::next_sample_gap()
 {
-	// Make sure the pool isn't full.
-	SHU_ASSERT(firstAvailable != nullptr);
+	//somewhere in [1, 2 * rate], so rate on average - xorshift so we dont disturb rand()
+	sampleRandom ^= sampleRandom << 13;
+	sampleRandom ^= sampleRandom >> 17;
+	sampleRandom ^= sampleRandom << 5;
+	return 1 + sampleRandom % (2 * sampleRate);
+}
 
-	// Remove it from the available list.
-	dataPack* newPack = firstAvailable;
-	firstAvailable = newPack->getNext();
-	newPack->live = 1;
+bool GuardedSamplingAllocator::take_sample()
+{
+	if (!sampleRate)
+		return false;
+	if (untilNextSample != 0)
+	{
+		--untilNextSample;
+		return false;
+	}
+	untilNextSample = next_sample_gap();
+	return true;
+}
 
-#if DATALOGGING_ON == 1
-	//record this as used
-	newPack->used = 1;
+bool GuardedSamplingAllocator::init_region()
+{
+	pageSize = get_page_size();
+	regionSize = pageSize * (2 * kMaxGuardedSlots + 1);
+
+#if defined(_WIN32)
+	region = (uint8_t*)VirtualAlloc(nullptr, regionSize, MEM_RESERVE | MEM_COMMIT, PAGE_NOACCESS);
+#else
+	void* p = mmap(nullptr, regionSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	region = (p == MAP_FAILED) ? nullptr : (uint8_t*)p;
 #endif
+	if (!region)
+		return false;
+
+	//register with the fault handler
+	for (size_t i(0); i < kMaxGuardedAllocators; ++i)
+	{
+		if (!g_guardedAllocators[i])
+		{
+			g_guardedAllocators[i] = this;
+			break;
+		}
+	}
+	install_guarded_fault_handler();
+	return true;
+}
+
+void* GuardedSamplingAllocator::allocate(size_t size, size_t alignment)
+{
+	//not this one - straight through
+	if (!take_sample())
+		return parentAllocator->allocate(size, alignment);
+	return allocate_sample(size, alignment);
+}
+
+void* GuardedSamplingAllocator::allocate_sample(size_t size, size_t alignment)
+{
+	if (!region && !init_region())
+		return parentAllocator->allocate(size, alignment);
 
-	return newPack;
+	if (size > pageSize || alignment > pageSize)
+		return parentAllocator->allocate(size, alignment);
+
+	//next slot that isnt in use, oldest released first
+	int slotIndex = -1;
+	for (size_t i(0); i < kMaxGuardedSlots; ++i)
+	{
+		size_t s = (nextSlot + i) % kMaxGuardedSlots;
+		if (!slots[s].live)
+		{
+			slotIndex = (int)s;
+			break;
+		}
+	}
+	if (slotIndex < 0)
+		return parentAllocator->allocate(size, alignment);
+	nextSlot = (slotIndex + 1) % kMaxGuardedSlots;
+
+	guardedSlot& slot = slots[slotIndex];
+	uint8_t* page = slot_page(slotIndex);
+	protect_pages(page, pageSize, true);
+
+	//push the allocation up against the guard page after it, as far as alignment allows
+	uintptr_t end = reinterpret_cast<uintptr_t>(page + pageSize);
+	if (alignment == 0)
+		alignment = 1;
+	slot.ptr = (uint8_t*)((end - size) & ~(uintptr_t)(alignment - 1));
+	slot.size = size;
+	slot.live = true;
+	slot.allocFrames = capture_stack(slot.allocStack, kMaxStackFrames);
+	slot.releaseFrames = 0;
+
+	++sampledCount;
+	return slot.ptr;
+}
+
+void* GuardedSamplingAllocator::allocate_zeroed(size_t size, size_t alignment)
+{
+	//not this one - the parent may know it is zero already
+	if (!take_sample())
+		return parentAllocator->allocate_zeroed(size, alignment);
+
+	//guarded slots are reused pages, so cleared
+	void* ret_p = allocate_sample(size, alignment);
+	if (ret_p)
+		zero_allocation(ret_p, size);
+	return ret_p;
+}
+
+void GuardedSamplingAllocator::release(void* ptr)
+{
+	int slotIndex = find_slot(ptr);
+	if (slotIndex < 0)
+	{
+		parentAllocator->release(ptr);
+		return;
+	}
+	release_slot(slotIndex, ptr);
+}
+
+void GuardedSamplingAllocator::release_sized(void* ptr, size_t size, size_t alignment)
+{
+	int slotIndex = find_slot(ptr);
+	if (slotIndex < 0)
+	{
+		parentAllocator->release_sized(ptr, size, alignment);
+		return;
+	}
+	release_slot(slotIndex, ptr);
+}
+
+void GuardedSamplingAllocator::release_slot(int slotIndex, void* ptr)
+{
+	guardedSlot& slot = slots[slotIndex];
+	SHU_ASSERT(slot.live && slot.ptr == ptr);
+
+	//lock it back up - any touch from here is a use after free
+	slot.live = false;
+	slot.releaseFrames = capture_stack(slot.releaseStack, kMaxStackFrames);
+	protect_pages(slot_page(slotIndex), pageSize, false);
+}
+
+bool GuardedSamplingAllocator::try_expand(void* ptr, size_t newSize)
+{
+	//samples are already pushed up against their guard page
+	if (find_slot(ptr) >= 0)
+		return false;
+	return parentAllocator->try_expand(ptr, newSize);
+}
+
+void GuardedSamplingAllocator::handle_signals(GameEventType sig)
+{
+	parentAllocator->handle_signals(sig);
+}
+
+bool GuardedSamplingAllocator::owns(const void* ptr)
+{
+	return find_slot(ptr) >= 0 || parentAllocator->owns(ptr);
+}
+
+//guarded samples are few and far between - budgets and profiling are the parent's
+void GuardedSamplingAllocator::for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const
+{
+	fn(parentAllocator);
+}
+
+size_t GuardedSamplingAllocator::get_bytes_in_use() const
+{
+	size_t used = IMemoryAllocatorX::get_bytes_in_use();
+	for (size_t i(0); i < kMaxGuardedSlots; ++i)
+	{
+		if (slots[i].live)
+			used += slots[i].size;
+	}
+	return used;
+}
+
+int GuardedSamplingAllocator::find_slot(const void* ptr) const
+{
+	uintptr_t s = reinterpret_cast<uintptr_t>(region);
+	uintptr_t p = reinterpret_cast<uintptr_t>(ptr);
+	if (!region || p < s || p >= s + regionSize)
+		return -1;
+
+	//odd pages are slots, even pages are guards
+	size_t page = (p - s) / pageSize;
+	if ((page & 1) == 0)
+		return -1;
+	return (int)(page / 2);
+}
+
+bool GuardedSamplingAllocator::report_fault(const void* addr)
+{
+	uintptr_t s = reinterpret_cast<uintptr_t>(region);
+	uintptr_t p = reinterpret_cast<uintptr_t>(addr);
+	if (!region || p < s || p >= s + regionSize)
+		return false;
+
+	//which slot does this belong to - for a guard page, the nearest live neighbour
+	size_t page = (p - s) / pageSize;
+	const char* kind = "use after free";
+	size_t slotIndex = page / 2;
+	if ((page & 1) == 0)
+	{
+		//guard page between slot page/2 - 1 (before it) and slot page/2 (after it)
+		//allocations sit against the guard after them, so an overrun of the one before is most likely
+		bool hasBefore = page > 0;
+		bool hasAfter = page / 2 < kMaxGuardedSlots;
+		if (hasBefore && (slots[page / 2 - 1].live || !hasAfter))
+		{
+			kind = "buffer overrun";
+			slotIndex = page / 2 - 1;
+		}
+		else
+		{
+			kind = "buffer underrun";
+			slotIndex = page / 2;
+		}
+	}
+
+	const guardedSlot& slot = slots[slotIndex];
+	faultReport report;
+	report.add("GUARDED ALLOCATION FAULT: ");
+	report.add(kind);
+	report.add(" at ");
+	report.add_number(p, 16);
+	report.add("\n  allocation ");
+	report.add_number(reinterpret_cast<uintptr_t>(slot.ptr), 16);
+	report.add(", ");
+	report.add_number(slot.size, 10);
+	report.add(slot.live ? " bytes (live)\n" : " bytes (released)\n");
+	report.flush();
+	print_stack("allocated at", slot.allocStack, slot.allocFrames);
+	if (!slot.live && slot.releaseFrames)
+		print_stack("released at", slot.releaseStack, slot.releaseFrames);
+
+	void* faultStack[kMaxStackFrames];
+	uint32_t faultFrames = capture_stack(faultStack, kMaxStackFrames);
+	print_stack("faulted at", faultStack, faultFrames);
+
+	return true;
+}
+
+GuardedSamplingAllocator::~GuardedSamplingAllocator()
+{
+	for (size_t i(0); i < kMaxGuardedAllocators; ++i)
+	{
+		if (g_guardedAllocators[i] == this)
+			g_guardedAllocators[i] = nullptr;
+	}
+
+	if (region)
+	{
+#if defined(_WIN32)
+		VirtualFree(region, 0, MEM_RELEASE);
+#else
+		munmap(region, regionSize);
+#endif
+		region = nullptr;
+	}
 }
 #pragma endregion
 
@@ -8,6 +8,84 @@
 #include <cstdlib>
 #include <memory>
 #include <list>
+#include <vector>
+#include <unordered_map>
+#include <new>
+#include <utility>
+#include <functional>
+#include <string>
+
+//std::pmr needs C++17 (/std:c++17 on MSVC) - the adapters are left out below that
+#if (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || (__cplusplus >= 201703L)
+#include <memory_resource>
+#define PMR_ADAPTERS_ON 1
+#else
+#define PMR_ADAPTERS_ON 0
+#endif
+
+#pragma region Allocation Tags
+//Who is allocating - set per thread with ScopedAllocTag, every allocator charges the current tag
+enum class AllocTag : uint8_t
+{
+	kUntagged,
+	kAudio,
+	kPhysics,
+	kUI,
+	kRender,
+	kAnimation,
+	kAI,
+	kGameplay,
+	kStreaming,
+
+	kMaxTags, // last one.
+};
+
+AllocTag get_current_alloc_tag();
+void set_current_alloc_tag(AllocTag tag);
+const char* get_alloc_tag_name(AllocTag tag);
+
+//sets the thread's allocation tag for the lifetime of the scope
+class ScopedAllocTag
+{
+public:
+	explicit ScopedAllocTag(AllocTag tag) : previousTag(get_current_alloc_tag()) { set_current_alloc_tag(tag); };
+	~ScopedAllocTag() { set_current_alloc_tag(previousTag); };
+
+	ScopedAllocTag(const ScopedAllocTag&) = delete;
+	ScopedAllocTag& operator = (const ScopedAllocTag&) = delete;
+private:
+	AllocTag previousTag;
+};
+#pragma endregion
+
+#pragma region Stack Capture
+//deepest call stack kept for a profiled / guarded allocation
+constexpr uint32_t kMaxStackFrames = 32;
+
+//return addresses of the caller's stack, most recent first
+uint32_t capture_stack(void** frames, uint32_t maxFrames);
+#pragma endregion
+
+#pragma region Trace Export
+//Chrome trace event JSON - load in chrome://tracing or ui.perfetto.dev.
+//Everything is a no-op until trace_open is called.
+bool trace_open(const char* filename);
+void trace_close();
+bool trace_is_open();
+//counter track sample, e.g. bytes in use for an allocator slot
+void trace_counter(const char* track, size_t value);
+//zero length marker across the whole timeline
+void trace_instant(const char* name);
+
+//times its scope as a slice on the calling thread
+struct ScopedTraceSlice {
+	ScopedTraceSlice(const char* sliceName);
+	~ScopedTraceSlice();
+private:
+	const char* name;
+	int64_t start;
+};
+#pragma endregion
 
 #pragma region IMemoryAllocator Extended Base
 //Extended IMemoryAllocator for testing and data gathering / signal handling
@@ -17,8 +95,37 @@ public:
 	virtual void* allocate(size_t size, size_t alignment) = 0;
 	virtual void release(void* ptr) = 0;
 
+	//CUSTOM - release when the caller still knows the size (std::pmr, containers)
+	//allocators that can do something with it override this, the rest just release
+	virtual void release_sized(void* ptr, size_t /*size*/, size_t /*alignment*/) { release(ptr); };
+
+	//CUSTOM - resizing
+	//grow an allocation without moving it - true if it now holds newSize (always when shrinking),
+	//false if it cant and nothing has changed
+	virtual bool try_expand(void* /*ptr*/, size_t /*newSize*/) { return false; };
+	//resize in place when possible, otherwise allocate, copy and release the old one
+	//nullptr if out of memory, in which case ptr is untouched
+	void* reallocate(void* ptr, size_t oldSize, size_t newSize, size_t alignment);
+
+	//CUSTOM - zero filled allocation
+	//allocate then clear - system blocks come from the CRT heap, so nothing is ever known to be zero already
+	virtual void* allocate_zeroed(size_t size, size_t alignment);
+	//bytes allocate_zeroed has cleared
+	size_t get_zero_cleared_bytes() const { return zeroClearedBytes; };
+
 	//CUSTOM FOR HANDLING SIGNALS
-	virtual void handle_signals(int sig) {  };
+	virtual void handle_signals(GameEventType /*sig*/) {  };
+
+	//CUSTOM - does this allocator own the memory at ptr
+	virtual bool owns(const void* /*ptr*/) { return false; };
+
+	//CUSTOM - composites
+	//calls fn once for each distinct allocator this one routes to, none for a leaf.
+	//Budgets, profiling, stats and snapshots below are done for this allocator then passed
+	//down through here, so a composite only has to override this to take part in them
+	virtual void for_each_child(const std::function<void(IMemoryAllocatorX*)>& /*fn*/) const {};
+
+	virtual ~IMemoryAllocatorX();
 
 	//CUSTOM - for measurements
 	void measure_usage(size_t size);
@@ -37,6 +144,111 @@ public:
 	void reset_maxNumActiveAllocations() { if(maxNumActiveAllocations > lastMaxNumActiveAllocations) lastMaxNumActiveAllocations = maxNumActiveAllocations; maxNumActiveAllocations = 0; };
 	bool get_maxNumActiveAllocations() { return maxNumActiveAllocations; };
 
+	//CUSTOM - per tag budgets, 0 means no budget
+	//soft: callback fires when usage crosses it, hard: allocation is refused (returns nullptr) and callback fires
+	typedef void (*BudgetCallback)(IMemoryAllocatorX* allocator, AllocTag tag, size_t used, size_t budget, bool isHard);
+
+	virtual void set_tag_budget(AllocTag tag, size_t softBudget, size_t hardBudget);
+	virtual void set_budget_callback(BudgetCallback cb);
+	void get_tag_budget(AllocTag tag, size_t& softBudget, size_t& hardBudget) const;
+	BudgetCallback get_budget_callback() const { return budgetCallback; };
+
+	virtual size_t get_tag_usage(AllocTag tag) const;
+	virtual size_t get_tag_peak(AllocTag tag) const;
+	bool is_over_soft_budget(AllocTag tag) const;
+	//all tags together - composite allocators sum what they route to
+	virtual size_t get_bytes_in_use() const;
+
+	//CUSTOM - statistical heap profile
+	//roughly one sample every sampleInterval bytes allocated (Poisson), each with its call stack
+	struct heapStackStats {
+		void* frames[kMaxStackFrames];
+		uint32_t frameCount = 0;
+		size_t inuseCount = 0;
+		size_t inuseBytes = 0;
+		size_t allocCount = 0;
+		size_t allocBytes = 0;
+	};
+	virtual void enable_heap_profile(size_t sampleInterval);
+	//sampled stacks with live (inuse) and all time (alloc) totals
+	virtual void gather_heap_profile(std::vector<heapStackStats>& stacks) const;
+	virtual size_t get_heap_profile_interval() const;
+	//writes the profile in pprof's legacy heap format - "pprof <binary> <file>"
+	bool dump_heap_profile(const char* filename) const;
+
+	//CUSTOM - fragmentation
+	//free extents are bucketed by power of two - bucket i counts extents of [2^i, 2^(i+1)) bytes
+	static constexpr size_t kFreeExtentBuckets = 32;
+	struct fragmentationStats {
+		size_t freeBytes = 0;
+		size_t freeExtentCount = 0;
+		size_t largestFreeExtent = 0;
+		size_t paddingBytes = 0;	//alignment padding and slot slack inside live allocations
+		size_t freeExtentHistogram[kFreeExtentBuckets] = {};
+		void add_free_extent(size_t size);
+	};
+	//adds to stats, so composites can gather their children into one
+	virtual void gather_fragmentation(fragmentationStats& stats) const;
+
+	//block layout for heat maps - occupancy of each granule, 0 empty to 255 full
+	struct layoutRegion {
+		const void* base;
+		size_t size;
+		uint32_t granule;
+		std::vector<uint8_t> occupancy;
+	};
+	virtual void gather_layout(std::vector<layoutRegion>& regions) const;
+	//binary snapshot, native endian: "MLAY", uint32 version, uint32 region count, then per region
+	//uint64 base, uint64 size, uint32 granule, uint32 granule count, then one occupancy byte per granule
+	bool dump_layout_snapshot(const char* filename) const;
+
+	//CUSTOM - checkpoints (see ArenaSnapshot)
+	//the memory a checkpoint has to copy - false if this allocator cant be checkpointed (malloc backed)
+	struct snapshotRegion {
+		uint8_t* base;
+		size_t size;
+	};
+	//a composite can be checkpointed when everything under it can
+	virtual bool get_snapshot_regions(std::vector<snapshotRegion>& regions) const;
+	//bookkeeping that goes with the memory - appended to state
+	virtual void save_snapshot_state(std::vector<uint8_t>& state) const;
+	//reads back what save_snapshot_state wrote, moving state past it
+	//checkOnly just answers whether the blocks still match, so a restore can be refused up front
+	virtual bool restore_snapshot_state(const uint8_t*& state, bool checkOnly);
+
+	//CUSTOM - sizing (see SizingProfile)
+	//the most this allocator has needed at once, in the unit it is sized in (bytes, slots for pools)
+	//0 if it doesnt know - those keep their built in size. A composite reports its biggest child
+	virtual size_t get_sizing_high_water() const;
+
+protected:
+	//call on every allocation / individual release - nearly free when profiling is off
+	void profile_allocation(const void* ptr, size_t size) { if (heapProfile && (profileCountdown -= (int64_t)size) <= 0) sample_allocation(ptr, size); };
+	void profile_release(const void* ptr) { if (heapProfile) unsample_allocation(ptr); };
+	//bulk frees drop every sample in the range, or all of them
+	void profile_release_range(const void* start, size_t size);
+	void profile_release_all();
+
+	//charge a tag for an allocation - false if it would break the tag's hard budget
+	bool charge_tag(AllocTag tag, size_t size);
+	//set_tag_budget without passing it down to children
+	void set_own_tag_budget(AllocTag tag, size_t softBudget, size_t hardBudget);
+	void refund_tag(AllocTag tag, size_t size);
+
+	//bulk frees (flush, ring wrap, rollback) reset or restore the usage counters
+	void reset_tag_usage();
+	void save_tag_usage(size_t* usage) const;
+	void restore_tag_usage(const size_t* usage);
+
+	//padding is wasted inside live allocations - allocators keep it up to date as they go
+	void add_padding(size_t bytes) { paddingBytes += bytes; };
+	void remove_padding(size_t bytes) { paddingBytes -= bytes; };
+	void set_padding_bytes(size_t bytes) { paddingBytes = bytes; };
+	size_t get_padding_bytes() const { return paddingBytes; };
+
+	//clears a zeroed allocation and counts it
+	void zero_allocation(void* ptr, size_t size);
+
 private:
 	//CUSTOM - helper members - measuring memory
 	size_t maxSpaceUsed = 0;
@@ -47,7 +259,70 @@ private:
 
 	//CUSTOM - bool for skipping repeat outputs on destruction
 	bool isDataOutputted = false;
+
+	//CUSTOM - per tag usage and budgets
+	struct tagBudget {
+		size_t used = 0;
+		size_t peak = 0;
+		size_t soft = 0;
+		size_t hard = 0;
+	};
+	tagBudget tagBudgets[(size_t)AllocTag::kMaxTags];
+	BudgetCallback budgetCallback = nullptr;
+
+	//CUSTOM - heap profile, only made when enabled
+	struct heapProfileData;
+	heapProfileData* heapProfile = nullptr;
+	int64_t profileCountdown = 0;
+	void sample_allocation(const void* ptr, size_t size);
+	void unsample_allocation(const void* ptr);
+
+	size_t paddingBytes = 0;
+
+	size_t zeroClearedBytes = 0;
+};
+#pragma endregion
+
+#pragma region NUMA Helpers
+//upper limit on nodes we keep per node allocators for
+constexpr int kMaxNumaNodes = 4;
+//no node preference - memory lands wherever the OS puts it
+constexpr int kAnyNumaNode = -1;
+
+//number of NUMA nodes on this machine (1 on non NUMA machines), capped at kMaxNumaNodes
+int get_numa_node_count();
+//node of the cpu the calling thread is running on
+int get_current_numa_node();
+#pragma endregion
+
+#pragma region System Block Broker
+//There are only 8 system blocks for the whole run, and a released one never frees up its slot.
+//So allocators dont take them directly: the broker reserves super blocks per mapping type
+//and hands out page aligned regions of them. Any number of allocators fit in a handful of blocks.
+//A super block is twice the last one of its type (kMinSuperBlockSize for the first), or the request
+//rounded up to kMinSuperBlockSize if that is bigger - a type that keeps growing needs few slots,
+//without a big block up front for types that never do.
+//Released regions go back on their super block's free list (merged with neighbours) for reuse.
+//System blocks come from the CRT heap, so free regions keep their pages - empty super blocks only go back at shutdown
+constexpr size_t kMinSuperBlockSize = 16 * MB;
+constexpr size_t kSystemRegionAlignment = 4 * KB;
+
+//a region of at least size bytes - with a node hint its pages are bound to that node on Linux
+void* acquire_system_region(size_t size, MemoryMappingType mappingType, int node = kAnyNumaNode);
+void release_system_region(void* ptr);
+//shutdown only - hands back every super block with nothing left in it, and the broker's own memory once
+//they have all gone. A slot never comes back, so a block given back any earlier could not be replaced.
+//returns how many super blocks are still held because something never released its region
+size_t release_empty_super_blocks();
+
+struct systemBrokerStats {
+	size_t superBlockCount;
+	size_t reservedBytes;
+	size_t regionCount;
+	size_t regionBytes;
+	size_t peakRegionBytes;
 };
+systemBrokerStats get_system_broker_stats();
 #pragma endregion
 
 #pragma region Unalligned Malloc
@@ -56,6 +331,7 @@ class MallocAllocator : public IMemoryAllocatorX
 {
 public:
 	virtual void* allocate(size_t size, size_t alignment) { return malloc(size); (void)alignment; }
+	virtual void* allocate_zeroed(size_t size, size_t alignment) { return calloc(1, size); (void)alignment; }
 	virtual void release(void* ptr) { free(ptr); }
 };
 #pragma endregion
@@ -65,8 +341,19 @@ public:
 class AlignedMallocAllocator : public IMemoryAllocatorX
 {
 public:
-	virtual void* allocate(size_t size, size_t alignment) { return _aligned_malloc(size, alignment); (void)alignment; }
-	virtual void release(void* ptr) { _aligned_free(ptr); }
+	virtual void* allocate(size_t size, size_t alignment);
+	virtual void release(void* ptr);
+
+	//always shrinks in place. Growing only works on Linux, into slack glibc already gave the block -
+	//elsewhere it fails and reallocate moves the allocation
+	bool try_expand(void* ptr, size_t newSize);
+
+	//stashed just in front of each allocation so release knows what to refund
+	struct allocPrefix {
+		size_t size;
+		uint32_t offset;	//from the malloc'd base to the returned pointer
+		AllocTag tag;
+	};
 };
 #pragma endregion
 
@@ -82,7 +369,7 @@ public:
 
 	virtual void release(void* ptr);
 
-	virtual void handle_signals(int sig);
+	virtual void handle_signals(GameEventType sig);
 
 	//accessors/setters
 	const size_t get_spaceRemaining() const { return spaceRemaining; };
@@ -91,10 +378,13 @@ public:
 
 	void set_spaceRemaining(size_t s) { spaceRemaining = s; };
 	void set_memblock(uint8_t* m) { memblock = m; };
-	void set_memLoc(uint8_t* m) { memLoc = m; };
+	void set_memLoc(uint8_t* m) { memLoc = m; topCount = 0; update_high_water(); };
 
-	//reset
-	void reset_memory_loc() { memLoc = memblock; };
+	//gets the main block now if it hasnt got one yet - false if the system is out of memory
+	virtual bool ensure_main_block();
+
+	//reset - whole block is free again
+	void reset_memory_loc() { memLoc = memblock; spaceRemaining = memorySize; topCount = 0; relocations.clear(); };
 
 	//size and type of memory access/set
 	const size_t get_memorySize() { return memorySize; };
@@ -105,14 +395,105 @@ public:
 
 	bool get_alignment_override() { return alignOverride; };
 
+	//node the system block is placed on
+	const int get_numaNode() { return numaNode; };
+	void set_numaNode(int n) { numaNode = n; };
+
+	virtual bool owns(const void* ptr);
+
+	//pops the allocation if it is the top of the main block, otherwise same as release
+	//a pop gives back the tag charge and padding too, so allocate / pop cycles dont build up usage
+	void release_sized(void* ptr, size_t size, size_t alignment);
+
+	//only the newest allocation in the main block can grow - charged to the tag it was made under
+	bool try_expand(void* ptr, size_t newSize);
+
+	//free extents are the tail of the block and of the newest overflow block, plus spare overflow blocks
+	void gather_fragmentation(fragmentationStats& stats) const;
+	void gather_layout(std::vector<layoutRegion>& regions) const;
+
+	//overflow - used when the main block cant fit an allocation
+	//a backup allocator is only tried once no more system blocks can be chained
+	void set_overflow_allocator(IMemoryAllocator* backup) { overflowAllocator = backup; };
+	const size_t get_overflow_count() { return overflowCount; };
+	const size_t get_overflow_bytes() { return overflowBytesPeak; };
+
+	//where the overflow chain is up to - lets rollback undo overflow made after a marker
+	struct overflowMark {
+		size_t entryCount = 0;
+		uint8_t* loc = nullptr;
+		size_t remaining = 0;
+	};
+	overflowMark mark_overflow() const;
+	void rollback_overflow(const overflowMark& mark);
+
+	//current overflow is no longer needed after the next retire (ring buffers)
+	void retire_overflow();
+	//done with all overflow - blocks are kept spare for next time, backup allocations given back
+	void release_overflow();
+	//give the spare overflow blocks back to the system
+	void release_spare_overflow();
+
+	//checkpoints - the used part of the block and every overflow block
+	bool get_snapshot_regions(std::vector<snapshotRegion>& regions) const;
+	void save_snapshot_state(std::vector<uint8_t>& state) const;
+	bool restore_snapshot_state(const uint8_t*& state, bool checkOnly);
+
+	//deepest the main block has been, or the whole block plus the worst overflow if it ever ran out
+	size_t get_sizing_high_water() const;
+
+	//arena images - the region from regionStart (block start by default, or a rollback marker)
+	//up to the top, written with a table of the pointer slots inside it
+	//record a slot inside the arena holding a pointer into it - fixed up if the image loads elsewhere
+	void add_relocation(void** slot);
+	bool save_image(const char* filename, const void* regionStart = nullptr) const;
+	//puts an image on top of the stack - mapped straight from the file when it can be
+	//returns where the region now starts, nullptr if it doesnt fit or the file is bad
+	void* load_image(const char* filename);
+
 	~StackAllocator();
 
+protected:
+	void* allocate_overflow(size_t size, size_t alignment);
+
+	//main block from the broker, remembering how much of it might not be zero
+	void acquire_main_block(size_t size);
+
+	//hands out ptr as the newest allocation in the main block, moving memLoc to its end - only the
+	//newest can grow in place or be popped. padding is what alignment skipped in front of it, tag what it was charged to
+	void push_top_allocation(void* ptr, size_t size, size_t padding, AllocTag tag);
+	//nothing below memLoc can be popped or grown any more (frame ends, markers)
+	void clear_top_allocations() { topCount = 0; };
+	//steps memLoc back over ptr and its padding, refunding both - false if ptr isnt the newest we know of
+	bool pop_top_allocation(void* ptr, size_t size);
+
+	//forget pointer slots at or above from - that memory has been given back
+	void drop_relocations(const uint8_t* from);
+
+	//overflow per frame (fenced rings) - the next overflow allocation starts a fresh block,
+	//so each block belongs to one frame and the oldest can be given back on their own
+	void seal_overflow();
+	size_t get_overflow_block_count() const { return overflowEntries.size(); };
+	void recycle_oldest_overflow(size_t count);
+
 private:
 	size_t spaceRemaining;
 	//Initial memory address
 	uint8_t* memblock = nullptr;
 	//address of next free space
 	uint8_t* memLoc = memblock;
+	//newest allocations in the main block, newest at topNext - 1 - a pop needs the tag and padding
+	//to refund. Only the last few are kept, anything older comes back in bulk like the rest of the stack
+	struct topRecord {
+		uint8_t* ptr;
+		uint32_t padding;
+		AllocTag tag;
+	};
+	static constexpr size_t kTopRecords = 16;
+	topRecord topRecords[kTopRecords] = {};
+	size_t topNext = 0;
+	size_t topCount = 0;
+	const topRecord* get_top_record() const { return topCount ? &topRecords[(topNext - 1) % kTopRecords] : nullptr; };
 
 	//size of memory we need to initialise the block as using
 	size_t memorySize = 0;
@@ -123,6 +504,44 @@ private:
 	//override alignments?
 	bool alignOverride = false;
 
+	//NUMA node hint for the system block
+	int numaNode = kAnyNumaNode;
+
+	//chained overflow blocks / backup allocations
+	struct overflowEntry {
+		uint8_t* mem;
+		size_t size;
+		bool fromBackup;
+	};
+	std::vector<overflowEntry> overflowEntries;
+	std::vector<overflowEntry> retiredOverflowEntries;
+	//system blocks are scarce, so finished overflow blocks are kept for reuse
+	std::vector<overflowEntry> spareOverflowEntries;
+	IMemoryAllocator* overflowAllocator = nullptr;
+
+	//furthest memLoc has been from memblock
+	size_t mainHighWater = 0;
+	//end of the main block pages load_image mapped from a file, nullptr if none
+	uint8_t* imageMapEnd = nullptr;
+	//maps fresh anonymous pages over the file mapped ones before the block goes back
+	void unmap_image_pages();
+	void update_high_water() { if (memblock && (size_t)(memLoc - memblock) > mainHighWater) mainHighWater = memLoc - memblock; };
+
+	//bump pointer into the newest overflow block
+	uint8_t* overflowLoc = nullptr;
+	size_t overflowRemaining = 0;
+
+	//finished with an entry - block goes spare, backup allocation is given back
+	void recycle_overflow(overflowEntry& e);
+
+	//overflow events - bytes per cycle (flush or ring wrap) size the next overflow block
+	size_t overflowCount = 0;
+	size_t overflowBytesCycle = 0;
+	size_t overflowBytesLastCycle = 0;
+	size_t overflowBytesPeak = 0;
+
+	//pointer slots for arena images, as offsets from memblock
+	std::vector<size_t> relocations;
 };
 #pragma endregion
 
@@ -132,20 +551,33 @@ public:
 	RollbackStackAllocator() = default;
 	RollbackStackAllocator(size_t size, MemoryMappingType type) { set_memorySize(size); set_memoryType(type); };
 
-	void place_marker() { rollback_marker = get_memLoc(); };
+	void place_marker() { rollback_marker = get_memLoc(); save_tag_usage(markerTagUsage); markerOverflow = mark_overflow(); markerPadding = get_padding_bytes(); clear_top_allocations(); };
 	void rollback_to_marker();
 	uint8_t* get_marker() { return rollback_marker; };
 
-	void handle_signals(int sig);
+	//never pops below the marker
+	void release_sized(void* ptr, size_t size, size_t alignment);
+
+	//the level loaded since the marker as an arena image
+	bool save_level_image(const char* filename) const { return save_image(filename, rollback_marker); };
+
+	//checkpoints carry the marker too
+	void save_snapshot_state(std::vector<uint8_t>& state) const;
+	bool restore_snapshot_state(const uint8_t*& state, bool checkOnly);
+
+	void handle_signals(GameEventType sig);
 private:
 	uint8_t* rollback_marker = nullptr;	//where to roll back to if we need to use rollback
+	size_t markerTagUsage[(size_t)AllocTag::kMaxTags] = {};	//tag usage when the marker was placed
+	overflowMark markerOverflow;	//overflow chain when the marker was placed
+	size_t markerPadding = 0;	//padding when the marker was placed
 };
 #pragma endregion
 
 #pragma region CPU Stack Allocator - UNUSED
 class CPUStackAllocator : public StackAllocator {
 public:
-	CPUStackAllocator() = default;
+	CPUStackAllocator() { set_memorySize(MB * 1); };
 	CPUStackAllocator(size_t memory) { set_memorySize(memory); };
 
 	virtual void* allocate(size_t size, size_t alignment);
@@ -155,16 +587,6 @@ public:
 };
 #pragma endregion
 
-#pragma region GPU Stack Allocator - UNUSED
-class GPUStackAllocator : public StackAllocator {
-public:
-	virtual void* allocate(size_t size, size_t alignment);
-	virtual void release(void* ptr);
-
-	~GPUStackAllocator();
-};
-#pragma endregion
-
 #pragma region Ring / Active Frame Stack Allocator
 class MultiFrameAllocator : public StackAllocator {
 public:
@@ -173,26 +595,361 @@ public:
 
 	void* allocate(size_t size, size_t alignment);
 
-	void handle_signals(int);
+	void handle_signals(GameEventType);
 	void inc_frame_count() { ++frameCount; };
 	void reset_frame_count() { frameCount = 0; };
 	const size_t get_frame_count() { return frameCount; };
 
+	void save_snapshot_state(std::vector<uint8_t>& state) const;
+	bool restore_snapshot_state(const uint8_t*& state, bool checkOnly);
+
 	~MultiFrameAllocator();
 private:
 	size_t frameCount = 0;
 };
 #pragma endregion
 
+#pragma region Fenced GPU Ring
+//fence values for work the GPU consumes - signalled once a frame's work is submitted, complete once
+//the GPU has finished reading everything submitted before it. Fences complete in order
+class IFenceTimeline {
+public:
+	virtual ~IFenceTimeline() = default;
+
+	virtual uint64_t signal() = 0;
+	virtual uint64_t get_completed_fence() const = 0;
+	//newest value handed out by signal
+	virtual uint64_t get_signalled_fence() const = 0;
+	//blocks until value is complete
+	virtual void wait_for_fence(uint64_t value) = 0;
+};
+
+//stand in GPU for testing - a consumer thread completes each fence latency after it was signalled,
+//plus up to jitter more so the lag varies frame to frame
+class SimulatedGpuTimeline : public IFenceTimeline {
+public:
+	SimulatedGpuTimeline(uint32_t latencyUs, uint32_t jitterUs = 0);
+	SimulatedGpuTimeline(const SimulatedGpuTimeline&) = delete;
+	SimulatedGpuTimeline& operator=(const SimulatedGpuTimeline&) = delete;
+
+	uint64_t signal();
+	uint64_t get_completed_fence() const;
+	uint64_t get_signalled_fence() const;
+	void wait_for_fence(uint64_t value);
+
+	//completes everything still pending straight away
+	~SimulatedGpuTimeline();
+
+private:
+	struct timelineState;
+	timelineState* state;
+};
+
+//no GPU at all - every fence is complete as soon as it is signalled, and nothing ever waits
+class ImmediateFenceTimeline : public IFenceTimeline {
+public:
+	uint64_t signal() { return ++fence; };
+	uint64_t get_completed_fence() const { return fence; };
+	uint64_t get_signalled_fence() const { return fence; };
+	void wait_for_fence(uint64_t) {};
+
+private:
+	uint64_t fence = 0;
+};
+
+//ring of per frame GPU data - a frame's region is only reused once the GPU is past the fence signalled
+//at the end of that frame, and the frame is minFrames old (CPU side readers). Nothing waits on a fixed
+//worst case lag: a full ring chains overflow blocks, and only when those run out does it wait on the oldest fence
+class FencedRingAllocator : public StackAllocator {
+public:
+	FencedRingAllocator(size_t memory, MemoryMappingType type, IFenceTimeline* fences, uint32_t minFrames = 0) : timeline(fences), minFramesInFlight(minFrames) { set_memorySize(memory); set_memoryType(type); };
+
+	void* allocate(size_t size, size_t alignment);
+
+	//only pops inside the current frame - older frames are already fenced
+	void release_sized(void* ptr, size_t size, size_t alignment);
+
+	void handle_signals(GameEventType sig);
+
+	//close the frame and signal its fence
+	void end_frame();
+	//take back every frame the GPU has finished with
+	void retire_completed();
+
+	size_t get_frames_in_flight() const { return frames.size(); };
+	//times a full ring had to wait on the GPU
+	size_t get_stall_count() const { return stallCount; };
+
+	//most bytes in flight at once, overflow included
+	size_t get_sizing_high_water() const { return inFlightHighWater; };
+
+	//ring position isnt part of the stack state, so no checkpoints
+	bool get_snapshot_regions(std::vector<snapshotRegion>& /*regions*/) const { return false; };
+
+	//waits for the GPU to be done with everything before the block goes
+	~FencedRingAllocator();
+
+private:
+	struct frameRecord {
+		uint8_t* end;
+		//went round the end of the block - end alone cant say, it can land right on the tail
+		bool wraps;
+		uint64_t fence;
+		uint64_t frameNumber;
+		size_t overflowBlocks;
+		size_t overflowBytes;
+		size_t padding;
+		size_t tagUsage[(size_t)AllocTag::kMaxTags];
+	};
+	//oldest first
+	std::vector<frameRecord> frames;
+
+	IFenceTimeline* timeline;
+	uint32_t minFramesInFlight;
+	uint64_t frameNumber = 0;
+
+	//oldest byte still in use - the head is memLoc
+	uint8_t* tail = nullptr;
+	//head has gone round the end and is now behind tail
+	bool wrapped = false;
+	//where the current frame started, for popping
+	uint8_t* frameStart = nullptr;
+	//the current frame has gone round the end
+	bool frameWraps = false;
+
+	//charges made before the current frame, so its own can be worked out at the end of it
+	size_t frameStartTags[(size_t)AllocTag::kMaxTags] = {};
+	size_t frameStartPadding = 0;
+	size_t queuedOverflowBlocks = 0;
+
+	size_t stallCount = 0;
+
+	//overflow bytes of frames not yet retired, and of the current frame on its own
+	size_t overflowBytesInFlight = 0;
+	size_t frameOverflowBytes = 0;
+	size_t inFlightHighWater = 0;
+	//tail to head, the end of the block skipped on a wrap included
+	size_t get_ring_bytes_in_use();
+
+	//room at the head without moving it - nullptr if the ring is full
+	void* find_space(size_t size, size_t alignment, bool& wraps);
+	void retire_front();
+	//free run at the head, for try_expand and the stats
+	void update_space_remaining();
+};
+#pragma endregion
+
+#pragma region Deferred Release Allocator
+//releases of memory the GPU may still be reading are queued instead of done - each is tagged with
+//the frame it came in and the next fence the GPU will pass, and handed to the parent in a batch at
+//kEventNextFrame once both minFrames have gone by and (with a timeline) that fence is complete.
+//A batch goes back highest address first, so a stack parent can pop a run of back to back frees off its top.
+//kEventLevelUnload waits for the GPU and flushes everything before the parent rolls back
+class DeferredReleaseAllocator : public IMemoryAllocatorX {
+public:
+	DeferredReleaseAllocator(IMemoryAllocatorX* parent, uint32_t minFrames, IFenceTimeline* fences = nullptr) : parentAllocator(parent), minFramesDeferred(minFrames), timeline(fences) {};
+
+	void* allocate(size_t size, size_t alignment);
+	void* allocate_zeroed(size_t size, size_t alignment);
+	void release(void* ptr);
+	void release_sized(void* ptr, size_t size, size_t alignment);
+	bool try_expand(void* ptr, size_t newSize);
+	void handle_signals(GameEventType sig);
+	bool owns(const void* ptr);
+
+	//hand back everything that is safe to now
+	void release_ready();
+	//wait for the GPU then hand back everything
+	void release_all();
+
+	size_t get_pending_count() const { return pending.size(); };
+	//bytes queued by release_sized - plain releases dont say
+	size_t get_pending_bytes() const { return pendingBytes; };
+	size_t get_deferred_release_count() const { return releasedCount; };
+
+	void for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const;
+	void save_snapshot_state(std::vector<uint8_t>& state) const;
+	bool restore_snapshot_state(const uint8_t*& state, bool checkOnly);
+
+	~DeferredReleaseAllocator();
+
+private:
+	struct pendingRelease {
+		void* ptr;
+		size_t size;	//0 for a plain release
+		size_t alignment;
+		uint64_t frameNumber;
+		uint64_t fence;
+	};
+	//in release order, so frames and fences only go up
+	std::vector<pendingRelease> pending;
+	//scratch for sorting a batch
+	std::vector<pendingRelease> batch;
+	size_t pendingBytes = 0;
+	size_t releasedCount = 0;
+
+	IMemoryAllocatorX* parentAllocator;
+	uint32_t minFramesDeferred;
+	IFenceTimeline* timeline;
+	uint64_t frameNumber = 0;
+
+	//gives the first count pending releases to the parent
+	void release_front(size_t count);
+};
+#pragma endregion
+
+#pragma region Self Relative Pointers
+//pointer stored as an offset from itself - stays valid however the arena holding it is moved,
+//so arena images made of these need no relocation at all
+template <class T>
+class SelfRelativePtr {
+public:
+	SelfRelativePtr() = default;
+	SelfRelativePtr(T* p) { set(p); };
+	SelfRelativePtr(const SelfRelativePtr& o) { set(o.get()); };
+	SelfRelativePtr& operator=(const SelfRelativePtr& o) { set(o.get()); return *this; };
+	SelfRelativePtr& operator=(T* p) { set(p); return *this; };
+
+	T* get() const { return offset ? (T*)((uint8_t*)this + offset) : nullptr; };
+	void set(T* p) { offset = p ? (uint8_t*)p - (uint8_t*)this : 0; };
+	T* operator->() const { return get(); };
+	T& operator*() const { return *get(); };
+	explicit operator bool() const { return offset != 0; };
+
+private:
+	//0 is null - a pointer to itself cant be expressed, which is fine
+	ptrdiff_t offset = 0;
+};
+#pragma endregion
+
+#pragma region Stack Containers
+//Growable array on a stack style allocator. Growth first tries to extend the buffer in place,
+//which works while it is the newest allocation - then it is just a pointer bump.
+//Otherwise it moves to a new allocation and the old one is left for the next flush / wrap.
+//It must not outlive the memory it sits in: a FrameVector is gone after the ring wraps,
+//a ScratchVector after the scratch flush.
+template <class T>
+class StackVector {
+public:
+	StackVector(StackAllocator* alloc, size_t initialCapacity = 0) : allocator(alloc) { if (initialCapacity) reserve(initialCapacity); };
+	StackVector(const StackVector&) = delete;
+	StackVector& operator=(const StackVector&) = delete;
+	StackVector(StackVector&& o) : allocator(o.allocator), items(o.items), count(o.count), capacity(o.capacity) { o.items = nullptr; o.count = o.capacity = 0; };
+
+	~StackVector()
+	{
+		clear();
+		//pops the buffer if nothing has been allocated on top of it
+		if (items)
+			allocator->release_sized(items, capacity * sizeof(T), alignof(T));
+	};
+
+	void push_back(const T& v) { emplace_back(v); };
+	void push_back(T&& v) { emplace_back(std::move(v)); };
+
+	template <class... Args>
+	T& emplace_back(Args&&... args)
+	{
+		if (count == capacity)
+			grow(count + 1);
+		SHU_ASSERT(count < capacity);
+		return *new(items + count++) T(std::forward<Args>(args)...);
+	};
+
+	void pop_back() { SHU_ASSERT(count > 0); items[--count].~T(); };
+	void clear() { while (count) items[--count].~T(); };
+
+	void reserve(size_t n) { if (n > capacity) grow(n); };
+	void resize(size_t n)
+	{
+		reserve(n);
+		while (count < n)
+			new(items + count++) T();
+		while (count > n)
+			items[--count].~T();
+	};
+
+	T& operator[](size_t i) { SHU_ASSERT(i < count); return items[i]; };
+	const T& operator[](size_t i) const { SHU_ASSERT(i < count); return items[i]; };
+	T* data() { return items; };
+	T* begin() { return items; };
+	T* end() { return items + count; };
+	const T* begin() const { return items; };
+	const T* end() const { return items + count; };
+	size_t size() const { return count; };
+	size_t get_capacity() const { return capacity; };
+	bool empty() const { return count == 0; };
+
+	//how many times growth had to copy rather than extend
+	size_t get_relocation_count() const { return relocations; };
+
+private:
+	StackAllocator* allocator;
+	T* items = nullptr;
+	size_t count = 0;
+	size_t capacity = 0;
+	size_t relocations = 0;
+
+	void grow(size_t minCapacity)
+	{
+		size_t newCapacity = capacity ? capacity * 2 : 8;
+		if (newCapacity < minCapacity)
+			newCapacity = minCapacity;
+
+		//top of the stack - take the doubled size if it fits, otherwise just what we need
+		if (items)
+		{
+			if (allocator->try_expand(items, newCapacity * sizeof(T)))
+			{
+				capacity = newCapacity;
+				return;
+			}
+			if (allocator->try_expand(items, minCapacity * sizeof(T)))
+			{
+				capacity = minCapacity;
+				return;
+			}
+		}
+
+		T* newItems = (T*)allocator->allocate(newCapacity * sizeof(T), alignof(T));
+		SHU_ASSERT(newItems != nullptr);
+		if (!newItems)
+			return;
+
+		for (size_t i(0); i < count; ++i)
+		{
+			new(newItems + i) T(std::move(items[i]));
+			items[i].~T();
+		}
+		if (items)
+		{
+			allocator->release_sized(items, capacity * sizeof(T), alignof(T));
+			++relocations;
+		}
+
+		items = newItems;
+		capacity = newCapacity;
+	};
+};
+
+//per frame arrays on SingleFrameCPU / SingleFrameGPU
+template <class T>
+using FrameVector = StackVector<T>;
+
+//scratch arrays - for the NUMA scratch slot pass get_node_allocator(get_current_numa_node())
+template <class T>
+using ScratchVector = StackVector<T>;
+#pragma endregion
+
 #pragma region CPU Multi Frame - UNUSED
 class CPUMFAllocator : public CPUStackAllocator {
 public:
-	CPUMFAllocator() = default;
+	CPUMFAllocator() { set_memorySize(KB * 159); };	//minimum needed for "SingleFrameCPU: Rapid short lived allocations (no release) (With Alignment Check)"
 	CPUMFAllocator(size_t memory) { set_memorySize(memory); };
 
 	void* allocate(size_t size, size_t alignment);
 
-	void handle_signals(int);
+	void handle_signals(GameEventType);
 	void inc_frame_count() { ++frameCount; };
 	void reset_frame_count() { frameCount = 0; };
 	const size_t get_frame_count() { return frameCount; };
@@ -203,48 +960,532 @@ private:
 };
 #pragma endregion
 
-#pragma region GPU Multi Frame Allocator - UNUSED
-class GPUMFAllocator : public CPUStackAllocator {
-public:
-	virtual void* allocate(size_t size, size_t alignment);
-
-	~GPUMFAllocator();
-};
-#pragma endregion
-
 #pragma region Object Pool
 class ObjectPoolManager : public StackAllocator {
 public:
 	ObjectPoolManager() = default;
-	ObjectPoolManager(size_t maxAllocs, MemoryMappingType type) { MaxAllocations = maxAllocs; set_memorySize(maxAllocs * sizeof(dataPack)); set_memoryType(type); };
+	ObjectPoolManager(size_t maxAllocs, MemoryMappingType type, size_t slabAllocs = 0) { MaxAllocations = maxAllocs; SlabAllocations = slabAllocs ? slabAllocs : maxAllocs; set_memorySize(maxAllocs * sizeof(dataPack)); set_memoryType(type); };
 
+	//one pack per allocation - nullptr for anything bigger than a pack or aligned past a cache line,
+	//a SegregatorAllocator in front sends those elsewhere.
+	//there is no free list in the packs: live state is in the slab bitmaps, out of line, and fresh packs come off the watermark
 	virtual void* allocate(size_t size, size_t alignment);
 	virtual void release(void* ptr);
 
-	void handle_signals(int sig) {};
+	//the first slab
+	bool ensure_main_block();
+
+	void handle_signals(GameEventType sig);
+
+	bool owns(const void* ptr) { return find_slab(ptr) != nullptr; };
+
+	//anything up to a whole pack fits
+	bool try_expand(void* ptr, size_t newSize);
+
+	//free extents are runs of free packs, padding is slot slack
+	void gather_fragmentation(fragmentationStats& stats) const;
+	void gather_layout(std::vector<layoutRegion>& regions) const;
+
+	//checkpoints copy whole slabs - the bitmaps and search hints live in them
+	bool get_snapshot_regions(std::vector<snapshotRegion>& regions) const;
+	void save_snapshot_state(std::vector<uint8_t>& state) const;
+	bool restore_snapshot_state(const uint8_t*& state, bool checkOnly);
+
+	//every pack free at once - only the slab watermarks are touched, not the packs or bitmaps
+	//nothing handed out before it may be used or released afterwards
+	void reset();
+
+	//give any fully empty overflow slabs back to the system
+	void shrink_slabs();
+	const size_t get_slab_count() { return slabCount; };
+
+	//occupancy queries - popcounts over the slab bitmaps
+	size_t get_live_count() const;
+	size_t get_used_count() const;
+	size_t get_capacity() const;
+
+	//most slots live at once
+	size_t get_sizing_high_water() const { return liveHighWater; };
 
 	~ObjectPoolManager();
 
-	//64 byte data elements w a pointer
-	struct dataPack {
-		/*uint8_t* prev = nullptr;*/
-		dataPack* next = nullptr;
-		bool live : 1;
-		bool used : 2;
+	//64 byte data elements - payload only, cache line sized and aligned
+	//all per-slot state lives out of line in the slab bitmaps
+	struct alignas(64) dataPack {
 		double_t d[8];
+	};
+
+	//header at the front of each system block the pool owns
+	//the first slab is sized by MaxAllocations, any overflow slabs by SlabAllocations
+	//occupancy is kept in dense bitmaps after the header rather than in the packs
+	//packs are handed out by bumping the watermark, the bitmap only has to find recycled ones below it,
+	//so nothing past the watermark is touched until it is needed
+	struct poolSlab {
+		poolSlab* next = nullptr;
+		dataPack* packs = nullptr;
+		size_t capacity = 0;
+
+		//one bit per pack, set while the pack is handed out - only means anything below the watermark
+		uint64_t* liveBits = nullptr;
+		size_t wordCount = 0;
+
+		//packs from here up havent been handed out since the slab was made or reset
+		size_t watermark = 0;
+		//highest the watermark has been - every pack below it has been handed out at some point
+		size_t usedCount = 0;
 
-		dataPack* getNext() const { return next; }
-		void setNext(dataPack* n) { next = n; }
+		//tag that was current when each pack was handed out
+		AllocTag* tags = nullptr;
+		//bytes of each live pack the caller didnt ask for
+		uint8_t* slack = nullptr;
+
+		//lowest word that might still have a free bit
+		size_t searchHint = 0;
+
+		//whole system block, header included
+		size_t blockSize = 0;
 	};
 
 private:
 	size_t MaxAllocations = 0;
-	dataPack* allocationPool;
-	uint8_t* endOfBlock;
+	size_t SlabAllocations = 0;
+
+	//chain of slabs, first one is never given back until shutdown
+	poolSlab* firstSlab = nullptr;
+	size_t slabCount = 0;
 
-	//free element finder
-	dataPack* firstAvailable;
-	dataPack* add_data();
+	//kept as we go - get_live_count walks every bitmap
+	size_t liveCount = 0;
+	size_t liveHighWater = 0;
+
+	//free element finder - lowest recycled pack, otherwise the next one past the watermark
+	dataPack* add_data(poolSlab*& slab);
+
+	//slab management
+	poolSlab* create_slab(size_t allocs);
+	poolSlab* find_slab(const void* ptr);
+};
+#pragma endregion
+
+#pragma region NUMA Local Allocator
+//Keeps one instance of an allocator per NUMA node and routes each allocation
+//to the instance on the calling thread's node. Instances are made on first use.
+class NumaLocalAllocator : public IMemoryAllocatorX {
+public:
+	//makes one node's instance - called again for each node that allocates
+	typedef std::function<StackAllocator*()> CreateFn;
+
+	NumaLocalAllocator(CreateFn create) : createAllocator(std::move(create)) {};
+
+	void* allocate(size_t size, size_t alignment);
+	void* allocate_zeroed(size_t size, size_t alignment);
+	void release(void* ptr);
+	void release_sized(void* ptr, size_t size, size_t alignment);
+	bool try_expand(void* ptr, size_t newSize);
+
+	//every node instance gets every signal
+	void handle_signals(GameEventType sig);
+
+	bool owns(const void* ptr);
+
+	//budgets and profiling set here are kept for node instances made later
+	void for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const;
+	//each node instance gets an equal share, so together they stay inside the budget
+	void set_tag_budget(AllocTag tag, size_t softBudget, size_t hardBudget);
+	//the peak of the summed usage, not the sum of each node's peak
+	size_t get_tag_peak(AllocTag tag) const;
+	bool get_snapshot_regions(std::vector<snapshotRegion>& regions) const;
+	//says which nodes had an instance, so a restore can tell the set has changed
+	void save_snapshot_state(std::vector<uint8_t>& state) const;
+	bool restore_snapshot_state(const uint8_t*& state, bool checkOnly);
+
+	StackAllocator* get_node_allocator(int node);
+
+	~NumaLocalAllocator();
+private:
+	CreateFn createAllocator;
+	StackAllocator* nodeAllocators[kMaxNumaNodes] = {};
+	size_t tagPeaks[(size_t)AllocTag::kMaxTags] = {};
+
+	//a node instance's share of a budget
+	static size_t node_share(size_t budget);
+	//the current node's instance, or one that already has memory when it cant get its own
+	StackAllocator* get_allocating_node();
+	//after anything that can raise usage
+	void update_tag_peak();
+};
+#pragma endregion
+
+#pragma region Allocator Combinators
+//Small building blocks that route between other allocators. They do not own
+//the allocators they route to - whoever made those deletes them.
+//Release is routed with owns(), so every allocator but the last one tried must implement it.
+
+//try primary, if it cant satisfy the request use fallback
+class FallbackAllocator : public IMemoryAllocatorX {
+public:
+	FallbackAllocator(IMemoryAllocatorX* primary, IMemoryAllocatorX* fallback) : primaryAllocator(primary), fallbackAllocator(fallback) {};
+
+	void* allocate(size_t size, size_t alignment);
+	void* allocate_zeroed(size_t size, size_t alignment);
+	void release(void* ptr);
+	void release_sized(void* ptr, size_t size, size_t alignment);
+	bool try_expand(void* ptr, size_t newSize);
+	void handle_signals(GameEventType sig);
+	bool owns(const void* ptr);
+
+	void for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const;
+private:
+	IMemoryAllocatorX* primaryAllocator;
+	IMemoryAllocatorX* fallbackAllocator;
+};
+
+//sizes up to and including threshold go to small, everything else to large
+class SegregatorAllocator : public IMemoryAllocatorX {
+public:
+	SegregatorAllocator(size_t threshold, IMemoryAllocatorX* small, IMemoryAllocatorX* large) : sizeThreshold(threshold), smallAllocator(small), largeAllocator(large) {};
+
+	void* allocate(size_t size, size_t alignment);
+	void* allocate_zeroed(size_t size, size_t alignment);
+	void release(void* ptr);
+	void release_sized(void* ptr, size_t size, size_t alignment);
+	bool try_expand(void* ptr, size_t newSize);
+	void handle_signals(GameEventType sig);
+	bool owns(const void* ptr);
+
+	void for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const;
+private:
+	size_t sizeThreshold;
+	IMemoryAllocatorX* smallAllocator;
+	IMemoryAllocatorX* largeAllocator;
+};
+
+//a list of size classes - an allocation goes to the first bucket it fits in
+class BucketizerAllocator : public IMemoryAllocatorX {
+public:
+	static constexpr size_t kMaxBuckets = 16;
+
+	BucketizerAllocator() = default;
+
+	//buckets must be added smallest first
+	void add_bucket(size_t maxSize, IMemoryAllocatorX* allocator);
+
+	void* allocate(size_t size, size_t alignment);
+	void* allocate_zeroed(size_t size, size_t alignment);
+	void release(void* ptr);
+	void release_sized(void* ptr, size_t size, size_t alignment);
+	bool try_expand(void* ptr, size_t newSize);
+	void handle_signals(GameEventType sig);
+	bool owns(const void* ptr);
+
+	void for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const;
+private:
+	struct bucket {
+		size_t maxSize;
+		IMemoryAllocatorX* allocator;
+	};
+	bucket buckets[kMaxBuckets];
+	size_t bucketCount = 0;
+
+	bool is_shared_bucket(size_t index) const;
+};
+
+//wraps each allocation from parent in guard bytes, checked on release
+class AffixAllocator : public IMemoryAllocatorX {
+public:
+	static constexpr uint8_t kGuardByte = 0xFD;
+	static constexpr uint32_t kHeaderMagic = 0xAFF1C5ED;
+
+	AffixAllocator(IMemoryAllocatorX* parent, size_t prefixGuard = 16, size_t suffixGuard = 16) : parentAllocator(parent), prefixGuardSize(prefixGuard), suffixGuardSize(suffixGuard) {};
+
+	void* allocate(size_t size, size_t alignment);
+	void release(void* ptr);
+	void release_sized(void* ptr, size_t size, size_t alignment);
+	bool try_expand(void* ptr, size_t newSize);
+	void handle_signals(GameEventType sig);
+	bool owns(const void* ptr);
+
+	void for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const;
+
+	//true if both guards around ptr are intact
+	bool check_guards(const void* ptr) const;
+
+	//kept between the prefix guard and the user pointer
+	struct affixHeader {
+		size_t size;
+		uint32_t offset;	//from the parent's pointer to the user pointer
+		uint32_t magic;
+	};
+private:
+	IMemoryAllocatorX* parentAllocator;
+	size_t prefixGuardSize;
+	size_t suffixGuardSize;
+};
+#pragma endregion
+
+#pragma region Guarded Sampling Allocator
+//Production safe overrun / use after free detection.
+//Roughly one in sampleRate allocations is given its own page, pushed up against
+//a no-access guard page, with another guard page in front. Released samples stay
+//no-access until the slot is reused. A fault in any of those pages prints the
+//allocation (and release) stacks before the process goes down as normal.
+//Anything not sampled, or bigger than a page, goes straight to the parent.
+//A rate of 0 turns sampling off - everything goes to the parent.
+class GuardedSamplingAllocator : public IMemoryAllocatorX {
+public:
+	static constexpr size_t kMaxGuardedSlots = 64;
+
+	GuardedSamplingAllocator(IMemoryAllocatorX* parent, uint32_t rate = 1000) : parentAllocator(parent), sampleRate(rate) { if (sampleRate) untilNextSample = next_sample_gap(); };
+
+	void* allocate(size_t size, size_t alignment);
+	void* allocate_zeroed(size_t size, size_t alignment);
+	void release(void* ptr);
+	void release_sized(void* ptr, size_t size, size_t alignment);
+	bool try_expand(void* ptr, size_t newSize);
+	void handle_signals(GameEventType sig);
+	bool owns(const void* ptr);
+
+	void for_each_child(const std::function<void(IMemoryAllocatorX*)>& fn) const;
+	//adds the live samples
+	size_t get_bytes_in_use() const;
+	//sampled pages arent in any region a checkpoint knows about
+	bool get_snapshot_regions(std::vector<snapshotRegion>& /*regions*/) const { return false; };
+
+	const size_t get_sampled_count() { return sampledCount; };
+
+	//called from the fault handler - writes a report to stderr and returns true if addr is one of our pages
+	//only async signal safe calls from here, it runs inside a SIGSEGV handler
+	bool report_fault(const void* addr);
+
+	~GuardedSamplingAllocator();
+
+	struct guardedSlot {
+		uint8_t* ptr = nullptr;
+		size_t size = 0;
+		bool live = false;
+		void* allocStack[kMaxStackFrames];
+		uint32_t allocFrames = 0;
+		void* releaseStack[kMaxStackFrames];
+		uint32_t releaseFrames = 0;
+	};
+
+private:
+	IMemoryAllocatorX* parentAllocator;
+
+	//one reservation: guard, slot, guard, slot ... guard
+	uint8_t* region = nullptr;
+	size_t pageSize = 0;
+	size_t regionSize = 0;
+	guardedSlot slots[kMaxGuardedSlots];
+	//slots are reused round robin so freed ones stay protected as long as possible
+	size_t nextSlot = 0;
+
+	//sampling countdown - randomised around sampleRate so patterns dont hide from it
+	uint32_t sampleRate;
+	uint32_t untilNextSample = 0;
+	uint32_t sampleRandom = 0x9E3779B9;
+	size_t sampledCount = 0;
+	//allocations to pass through before the next sample - only called with a rate
+	uint32_t next_sample_gap();
+	//counts down to the next sample - false for anything that goes straight to the parent
+	bool take_sample();
+	//a guarded slot for the allocation, or the parent's memory if it cant have one
+	void* allocate_sample(size_t size, size_t alignment);
+
+	bool init_region();
+	void release_slot(int slotIndex, void* ptr);
+	uint8_t* slot_page(size_t i) const { return region + pageSize * (2 * i + 1); };
+	int find_slot(const void* ptr) const;
+};
+#pragma endregion
+
+#pragma region PMR Adapters
+#if PMR_ADAPTERS_ON == 1
+//std::pmr::memory_resource over one of our allocators so pmr containers can sit on any slot
+//sizes from do_deallocate are passed on with release_sized
+//memory_resource has no way to fail quietly - running out throws std::bad_alloc
+class AllocatorResource : public std::pmr::memory_resource {
+public:
+	AllocatorResource(IMemoryAllocatorX* alloc) : allocator(alloc) {};
+	IMemoryAllocatorX* get_allocator() const { return allocator; };
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* ptr, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+private:
+	IMemoryAllocatorX* allocator;
+};
+
+//monotonic_buffer_resource style fast path for the stack and frame allocators
+//allocate calls TStack directly rather than through the vtable, deallocate only pops
+//the top allocation - everything else waits for the flush / frame wrap / rollback
+template <class TStack>
+class StackResource : public std::pmr::memory_resource {
+public:
+	StackResource(TStack* s) : stack(s) {};
+	TStack* get_allocator() const { return stack; };
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		void* ptr = stack->TStack::allocate(bytes, alignment);
+		if (!ptr)
+			throw std::bad_alloc();
+		return ptr;
+	};
+	void do_deallocate(void* ptr, size_t bytes, size_t alignment) override { stack->TStack::release_sized(ptr, bytes, alignment); };
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; };
+
+private:
+	TStack* stack;
+};
+
+//one resource per MemoryAllocatorSet slot
+struct MemoryResourceSet {
+	std::pmr::memory_resource* GeneralHeap;
+	std::pmr::memory_resource* SmallObject;
+	std::pmr::memory_resource* ScratchSpace;
+	std::pmr::memory_resource* SingleFrameCPU;
+	std::pmr::memory_resource* SingleFrameGPU;
+	std::pmr::memory_resource* LevelCPU;
+	std::pmr::memory_resource* LevelGPU;
+};
+#endif
+#pragma endregion
+
+#pragma region Level Streaming
+//Streams a level manifest straight into an arena (LevelGPU in the harness).
+//begin_load reserves every entry in one pass, then worker threads fill them with
+//reads split into chunks so many are in flight at once - no staging buffers.
+//Reserved ranges belong to the arena, so a failed load is cleaned up by the level unload.
+class LevelStreamer {
+public:
+	static constexpr size_t kChunkSize = 1 * MB;
+
+	struct manifestEntry {
+		const char* path;
+		uint64_t fileOffset;
+		size_t size;
+		size_t alignment;
+		void* dest;	//filled in by begin_load
+	};
+
+	LevelStreamer(IMemoryAllocatorX* arena, uint32_t workerCount = 4);
+	~LevelStreamer();
+
+	//false if anything couldnt be reserved or opened - nothing is read in that case
+	bool begin_load(manifestEntry* entries, size_t count);
+	bool is_complete() const;
+	//blocks until every read has landed - true if they all read in full
+	bool wait_complete();
+
+	size_t get_bytes_read() const;
+
+private:
+	IMemoryAllocatorX* arenaAllocator;
+	uint32_t workerCount;
+
+	//threads, queue and open files - kept out of the header
+	struct streamState;
+	streamState* state;
+
+	void start_workers();
+	void worker_loop();
+};
+#pragma endregion
+
+#pragma region Arena Snapshots
+//Checkpoints of a set of allocators - their used memory plus their bookkeeping - for
+//rollback netcode and rewind. After the first capture only pages written since the last
+//capture / restore are copied, where the OS can tell us which (soft dirty bits on Linux),
+//otherwise the whole used extent is. Captures go out with non-temporal stores.
+//restore is all or nothing: if any allocator's blocks have changed shape since the
+//capture (new overflow, slabs added or dropped) nothing is touched and it returns false.
+//Nothing else may write to the allocators while either runs - workers that do (LevelStreamer,
+//UploadStager) are waited on through quiesce hooks first.
+class ArenaSnapshot {
+public:
+	ArenaSnapshot() = default;
+	ArenaSnapshot(const ArenaSnapshot&) = delete;
+	ArenaSnapshot& operator=(const ArenaSnapshot&) = delete;
+	~ArenaSnapshot();
+
+	void add_allocator(IMemoryAllocatorX* allocator) { allocators.push_back(allocator); captured = false; };
+	//called before every capture and restore - should block until that worker has stopped writing (wait_complete)
+	void add_quiesce_hook(std::function<void()> hook) { quiesceHooks.push_back(std::move(hook)); };
+
+	bool capture();
+	bool restore();
+
+	//bytes copied by the last capture / restore
+	size_t get_last_copy_bytes() const { return lastCopyBytes; };
+	bool is_dirty_tracking_on() const;
+
+private:
+	struct regionCopy {
+		uint8_t* base;
+		size_t size;
+		uint8_t* copy;
+		size_t capacity;
+	};
+
+	std::vector<IMemoryAllocatorX*> allocators;
+	std::vector<std::function<void()>> quiesceHooks;
+	std::vector<std::vector<uint8_t>> states;
+	std::vector<regionCopy> copies;
+	bool captured = false;
+	size_t lastCopyBytes = 0;
+	//dirty bits are process wide - if anyone else cleared them since, ours mean nothing
+	uint64_t dirtyEpoch = 0;
+
+	void clear_dirty_pages();
+};
+#pragma endregion
+
+#pragma region Upload Staging
+//Batches CPU to GPU mapped copies (SingleFrameCPU sources into LevelGPU, say) instead of one
+//memcpy per resource. Copies queue up during the frame; flush at the frame boundary sorts them
+//by destination, merges runs that are back to back at both ends, and streams each run out with
+//non-temporal stores - GPU mapped memory is write combined, so nothing is gained by caching it.
+//With a worker a batch runs in the background until wait_complete, or the next flush, which waits
+//for it first - sources and destinations must stay put until then. Nothing orders it against
+//fences or frame resets, so the owner waits before reusing a source or signalling a fence.
+class UploadStager {
+public:
+	UploadStager(bool useWorker = false);
+	UploadStager(const UploadStager&) = delete;
+	UploadStager& operator=(const UploadStager&) = delete;
+	~UploadStager();
+
+	void queue_copy(void* dst, const void* src, size_t size);
+	//allocates the destination from gpuAllocator and queues the copy into it - nullptr if that fails
+	void* queue_upload(IMemoryAllocatorX* gpuAllocator, const void* src, size_t size, size_t alignment);
+
+	//frame boundary - waits for the last batch then starts this one
+	void flush();
+	//blocks until every flushed copy has landed
+	void wait_complete();
+
+	size_t get_queued_count() const;
+	//totals over every finished batch
+	uint64_t get_bytes_uploaded() const;
+	size_t get_request_count() const;
+	//copies actually made after merging
+	size_t get_copy_count() const;
+	//bytes per second while copying
+	double get_upload_bandwidth() const;
+
+private:
+	bool useWorker;
+
+	//queues, worker and stats - kept out of the header
+	struct stagingState;
+	stagingState* state;
+
+	void run_batch();
+	void worker_loop();
 };
 #pragma endregion
 
@@ -290,6 +1531,79 @@ private:
 //};
 #pragma endregion
 
+#pragma region Sizing Profile
+//Allocator capacities from a previous run rather than guesses. A recording run saves each allocator's
+//high water mark by name, later runs load the file and size to it plus a safety margin.
+//Text, one "name highWater" per line, '#' lines are comments - hand edits are fine
+class SizingProfile {
+public:
+	//0.25 sizes to 125% of the recorded high water
+	SizingProfile(float safetyMargin = 0.0f) : margin(safetyMargin) {};
+
+	//false if the file isnt there or cant be read - every size is then its fallback
+	bool load(const char* filename);
+	bool save(const char* filename) const;
+
+	//replaces any earlier value for name
+	void record(const char* name, size_t highWater);
+	//0 if name isnt in the profile
+	size_t get_high_water(const char* name) const;
+
+	//high water plus the margin, rounded up to granule - fallback if name wasnt profiled
+	size_t get_size(const char* name, size_t fallback, size_t granule = 1) const;
+
+	void set_safety_margin(float safetyMargin) { margin = safetyMargin; };
+	float get_safety_margin() const { return margin; };
+	size_t get_entry_count() const { return entries.size(); };
+
+private:
+	struct entry {
+		std::string name;
+		size_t highWater;
+	};
+	//in record order, so saved files diff cleanly between runs
+	std::vector<entry> entries;
+	float margin;
+};
+#pragma endregion
+
+#pragma region Lifetime Events
+//Who reacts to which lifetime event, and in what order - a signal is just a walk of that event's list.
+//Lower priority runs first, ties in the order they subscribed. Lists are sorted as listeners subscribe,
+//never while dispatching, so dont subscribe from inside a callback. Event values past kMaxEventTypes
+//are free for new lifetimes (sublevels, streaming cells, cutscenes) and dispatch the same way
+class LifetimeEventRegistry {
+public:
+	using Callback = std::function<void(GameEventType)>;
+
+	static constexpr int kPriorityFirst = -100;
+	static constexpr int kPriorityDefault = 0;
+	static constexpr int kPriorityLast = 100;
+
+	//returns an id for unsubscribe
+	uint32_t subscribe(GameEventType evt, int priority, Callback callback);
+	//member callback - obj has to outlive the subscription
+	template <class T>
+	uint32_t subscribe(GameEventType evt, int priority, T* obj, void (T::*method)(GameEventType)) { return subscribe(evt, priority, [obj, method](GameEventType e) { (obj->*method)(e); }); };
+	//the event goes to the allocator's handle_signals
+	uint32_t subscribe_allocator(GameEventType evt, int priority, IMemoryAllocatorX* allocator);
+	void unsubscribe(uint32_t id);
+
+	void dispatch(GameEventType evt) const;
+	size_t get_listener_count(GameEventType evt) const;
+
+private:
+	struct listener {
+		uint32_t id;
+		int priority;
+		Callback callback;
+	};
+	//per event, in run order
+	std::vector<std::vector<listener>> events;
+	uint32_t nextId = 0;
+};
+#pragma endregion
+
 // Modify this test harness to setup your allocators 
 // and pass them to the test suite.
 class AssignmentTestHarness
@@ -302,19 +1616,64 @@ public:
 	//collection of allocators
 	MemoryAllocatorSet m_memAllocSet;
 
+	//submit level manifests here between kEventLevelBeginLoad and kEventLevelLoadComplete
+	//nullptr unless ASYNC_GPU_ON is set
+	LevelStreamer* get_level_streamer() { return m_pLevelStreamer; };
+
+	//queue CPU to GPU copies here - they land a frame later, and before kEventLevelLoadComplete returns
+	//with ASYNC_GPU_ON off they are copied on the signalling thread at the frame boundary instead
+	UploadStager* get_upload_stager() { return m_pUploadStager; };
+
+	//lifetime events - other systems and new lifetimes subscribe here, signal dispatches through it
+	LifetimeEventRegistry& get_event_registry() { return m_eventRegistry; };
+
+#if PMR_ADAPTERS_ON == 1
+	//the same slots as std::pmr resources - e.g. std::pmr::vector<int> v(m_memResourceSet.ScratchSpace);
+	MemoryResourceSet m_memResourceSet;
+#endif
+
 private:
 	MallocAllocator m_simpleAllocator;
 	AlignedMallocAllocator m_alignedMalloc;
 
+	//who handles which event, set up once the slots are final
+	LifetimeEventRegistry m_eventRegistry;
+	void subscribe_lifetime_events();
+
 	//Things with constuction parameters
 	StackAllocator* m_pSmallObjStackAllocator;
-	StackAllocator* m_pStackAllocator;
+	NumaLocalAllocator* m_pStackAllocator;
 	MultiFrameAllocator* m_pCPUMFAllocator;
-	MultiFrameAllocator* m_pGPUMFAllocator;
+
+	//SingleFrameGPU - frames come back as the (simulated) GPU retires their fences
+	IFenceTimeline* m_pGpuTimeline;
+	FencedRingAllocator* m_pGPURing;
 
 	//Level tests - CPU used for system data - GPU used for unloaded/loaded levels
 	StackAllocator* m_pCPULevelStack;
 	RollbackStackAllocator* m_pRollbackGPU;
 
-	ObjectPoolManager* m_pSmallObjectPool;
+	NumaLocalAllocator* m_pSmallObjectPool;
+
+	//routing - small sizes to the pool, anything bigger to the general heap
+	SegregatorAllocator* m_pSmallObjectRouter;
+
+	//SmallObject's route for anything too big for the pool - kept apart from GeneralHeap so stats dont mix
+	AlignedMallocAllocator m_smallObjectOverflow;
+
+	//bytes in use of every slot as trace counter tracks
+	void trace_slot_usage();
+
+	//LevelGPU releases wait for the GPU before going back to the rollback stack
+	DeferredReleaseAllocator* m_pDeferredLevelGPU = nullptr;
+
+	//level data streamed into LevelGPU, finished before kEventLevelLoadComplete returns
+	LevelStreamer* m_pLevelStreamer = nullptr;
+
+	//CPU to GPU copies, run in batches at kEventNextFrame
+	UploadStager* m_pUploadStager;
+
+	//sampled guard page checking in front of GeneralHeap and SmallObject
+	GuardedSamplingAllocator* m_pGuardedGeneralHeap = nullptr;
+	GuardedSamplingAllocator* m_pGuardedSmallObject = nullptr;
 };